@@ -34,8 +34,33 @@ int main(int argc, char* argv[])
 
    auto content = share(dynamic_list{ my_composer });
 
+   // Clearing erases far more rows than are resident. Adding rows to the
+   // cleared list streams them into an empty one.
+   auto clear = button("Clear");
+   auto add = button("Add 100 Rows");
+
+   clear.on_click =
+      [content, my_composer, &view_](bool)
+      {
+         content->erase(0, my_composer->size());
+         view_.layout(*content);
+      };
+
+   add.on_click =
+      [content, my_composer, &view_](bool)
+      {
+         content->insert(my_composer->size(), 100);
+         view_.layout(*content);
+      };
+
    view_.content(
-      vscroller(hold(content)),
+      vtile(
+         vscroller(hold(content)),
+         htile(
+            margin({ 10, 10, 5, 10 }, clear),
+            margin({ 5, 10, 10, 10 }, add)
+         )
+      ),
       background
    );
 
@@ -10,17 +10,13 @@ using namespace std::chrono_literals;
 
 float position = 0.0;
 constexpr float incr = 0.001;
-constexpr auto fps = 1000ms / 60;
 
-void animate(view& view_, vport_element& port)
+bool animate(view& view_, vport_element& port)
 {
-   position += incr;
-   if (position < 1.0)
-      view_.post(fps, [&]() { animate(view_, port); });
-   else
-      position = 1.0;
+   position = std::min(position + incr, 1.0f);
    port.valign(position);
    view_.refresh();
+   return position < 1.0;
 }
 
 int main(int argc, char* argv[])
@@ -34,7 +30,7 @@ int main(int argc, char* argv[])
    auto port = share(vport(image{ "moving.png" }));
    view_.content(port);
 
-   view_.post(fps, [&]() { animate(view_, *port); });
+   view_.animate([&](auto /* now */) { return animate(view_, *port); });
 
    _app.run();
    return 0;
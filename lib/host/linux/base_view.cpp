@@ -12,8 +12,12 @@
 #include <elements/support/resource_paths.hpp>
 #include <elements/support/text_utils.hpp>
 #include <gtk/gtk.h>
+#include <algorithm>
+#include <cmath>
 #include <map>
+#include <mutex>
 #include <string>
+#include <vector>
 
 namespace cycfi { namespace elements
 {
@@ -22,7 +26,14 @@ namespace cycfi { namespace elements
       host_view();
       ~host_view();
 
+      // The retained backbuffer. We render only the damaged parts of the
+      // view into it, and copy the exposed areas from it to the window.
       cairo_surface_t* surface = nullptr;
+      int surface_width = 0;
+      int surface_height = 0;
+      int surface_scale = 0;
+      cairo_region_t* damage = nullptr;
+
       GtkWidget* widget = nullptr;
 
       // Mouse button click tracking
@@ -42,6 +53,14 @@ namespace cycfi { namespace elements
       GtkIMContext* im_context;
 
       GdkCursorType active_cursor_type = GDK_ARROW;
+
+      // Pending poll sources (see base_view::wake)
+      std::mutex poll_mutex;
+      guint idle_source = 0;
+      std::vector<guint> timer_sources;
+
+      // Frame clock tick callback (see base_view::start_frames)
+      guint tick_callback = 0;
    };
 
    struct platform_access
@@ -53,7 +72,8 @@ namespace cycfi { namespace elements
    };
 
    host_view::host_view()
-    : im_context(gtk_im_context_simple_new())
+    : damage(cairo_region_create())
+    , im_context(gtk_im_context_simple_new())
    {
    }
 
@@ -62,6 +82,7 @@ namespace cycfi { namespace elements
       if (surface)
          cairo_surface_destroy(surface);
       surface = nullptr;
+      cairo_region_destroy(damage);
    }
 
    namespace
@@ -75,19 +96,52 @@ namespace cycfi { namespace elements
          return *reinterpret_cast<base_view*>(user_data);
       }
 
+      void add_damage(host_view* host_view_h, cairo_rectangle_int_t const& r)
+      {
+         if (r.width > 0 && r.height > 0)
+            cairo_region_union_rectangle(host_view_h->damage, &r);
+      }
+
       gboolean on_configure(GtkWidget* widget, GdkEventConfigure* /* event */, gpointer user_data)
       {
          auto& view = get(user_data);
          auto* host_view_h = platform_access::get_host_view(view);
 
-         if (host_view_h->surface)
-            cairo_surface_destroy(host_view_h->surface);
+         auto width = gtk_widget_get_allocated_width(widget);
+         auto height = gtk_widget_get_allocated_height(widget);
+         auto scale = gtk_widget_get_scale_factor(widget);
+
+         // Keep the backbuffer if the view still fits. Otherwise, grow it
+         // with some headroom so that interactive resizing does not
+         // reallocate it on every configure event.
+         if (!host_view_h->surface
+            || width > host_view_h->surface_width
+            || height > host_view_h->surface_height
+            || scale != host_view_h->surface_scale)
+         {
+            auto grow = [](int have, int need)
+            {
+               return need <= have ? have : std::max(need, have + have / 4);
+            };
+
+            if (host_view_h->surface)
+               cairo_surface_destroy(host_view_h->surface);
+
+            if (scale != host_view_h->surface_scale)
+               host_view_h->surface_width = host_view_h->surface_height = 0;
+            host_view_h->surface_width = grow(host_view_h->surface_width, width);
+            host_view_h->surface_height = grow(host_view_h->surface_height, height);
+            host_view_h->surface_scale = scale;
+
+            host_view_h->surface = gdk_window_create_similar_surface(
+               gtk_widget_get_window(widget), CAIRO_CONTENT_COLOR,
+               host_view_h->surface_width,
+               host_view_h->surface_height
+            );
+         }
 
-         host_view_h->surface = gdk_window_create_similar_surface(
-            gtk_widget_get_window(widget), CAIRO_CONTENT_COLOR,
-            gtk_widget_get_allocated_width(widget),
-            gtk_widget_get_allocated_height(widget)
-         );
+         // The layout changes with the size, so everything is damaged
+         add_damage(host_view_h, { 0, 0, width, height });
          return true;
       }
 
@@ -95,18 +149,60 @@ namespace cycfi { namespace elements
       {
          auto& view = get(user_data);
          auto* host_view_h = platform_access::get_host_view(view);
+
+         if (!host_view_h->surface)
+         {
+            // Note that cr (cairo_t) is already clipped to only draw the
+            // exposed areas of the widget.
+            double left, top, right, bottom;
+            cairo_clip_extents(cr, &left, &top, &right, &bottom);
+            view.draw(
+               cr,
+               rect{ float(left), float(top), float(right), float(bottom) }
+            );
+            return false;
+         }
+
+         // Render the damaged areas into the backbuffer
+         auto* damage = host_view_h->damage;
+         if (!cairo_region_is_empty(damage))
+         {
+            auto* surface_cr = cairo_create(host_view_h->surface);
+            for (int i = 0, n = cairo_region_num_rectangles(damage); i != n; ++i)
+            {
+               cairo_rectangle_int_t r;
+               cairo_region_get_rectangle(damage, i, &r);
+               cairo_rectangle(surface_cr, r.x, r.y, r.width, r.height);
+            }
+            cairo_clip(surface_cr);
+
+            // Start from a clean slate, as a new surface would
+            cairo_save(surface_cr);
+            cairo_set_operator(surface_cr, CAIRO_OPERATOR_SOURCE);
+            cairo_set_source_rgb(surface_cr, 0, 0, 0);
+            cairo_paint(surface_cr);
+            cairo_restore(surface_cr);
+
+            cairo_rectangle_int_t extents;
+            cairo_region_get_extents(damage, &extents);
+            cairo_region_destroy(damage);
+            host_view_h->damage = cairo_region_create();
+
+            view.draw(
+               surface_cr,
+               rect{
+                  float(extents.x), float(extents.y)
+                , float(extents.x + extents.width), float(extents.y + extents.height)
+               }
+            );
+            cairo_destroy(surface_cr);
+         }
+
+         // Copy the exposed areas. cr is already clipped to them.
          cairo_set_source_surface(cr, host_view_h->surface, 0, 0);
+         cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
          cairo_paint(cr);
 
-         // Note that cr (cairo_t) is already clipped to only draw the
-         // exposed areas of the widget.
-         double left, top, right, bottom;
-         cairo_clip_extents(cr, &left, &top, &right, &bottom);
-         view.draw(
-            cr,
-            rect{ float(left), float(top), float(right), float(bottom) }
-         );
-
          return false;
       }
 
@@ -372,11 +468,46 @@ namespace cycfi { namespace elements
          base_view.end_focus();
    }
 
-   int poll_function(gpointer user_data)
+   gboolean on_idle_poll(gpointer user_data)
    {
       auto& base_view = get(user_data);
+      auto* host_view_h = platform_access::get_host_view(base_view);
+      {
+         std::lock_guard<std::mutex> lock(host_view_h->poll_mutex);
+         host_view_h->idle_source = 0;
+      }
       base_view.poll();
-      return true;
+      return G_SOURCE_REMOVE;
+   }
+
+   struct poll_timer
+   {
+      base_view* view;
+      guint id;
+   };
+
+   gboolean on_timer_poll(gpointer user_data)
+   {
+      auto* timer = reinterpret_cast<poll_timer*>(user_data);
+      auto* host_view_h = platform_access::get_host_view(*timer->view);
+      {
+         std::lock_guard<std::mutex> lock(host_view_h->poll_mutex);
+         auto& ids = host_view_h->timer_sources;
+         ids.erase(std::remove(ids.begin(), ids.end(), timer->id), ids.end());
+      }
+      timer->view->poll();
+      return G_SOURCE_REMOVE;
+   }
+
+   void delete_poll_timer(gpointer user_data)
+   {
+      delete reinterpret_cast<poll_timer*>(user_data);
+   }
+
+   gboolean on_frame(GtkWidget* /* widget */, GdkFrameClock* /* clock */, gpointer user_data)
+   {
+      get(user_data).frame();
+      return G_SOURCE_CONTINUE;
    }
 
    GtkWidget* make_view(base_view& view, GtkWidget* parent)
@@ -434,9 +565,6 @@ namespace cycfi { namespace elements
       g_signal_connect(view.host()->im_context, "commit",
          G_CALLBACK(on_text_entry), &view);
 
-      // Create 1ms timer
-      g_timeout_add(1, poll_function, &view);
-
       return content_view;
    }
 
@@ -489,6 +617,15 @@ namespace cycfi { namespace elements
    {
       if (host_view_under_cursor == _view)
          host_view_under_cursor = nullptr;
+
+      {
+         std::lock_guard<std::mutex> lock(_view->poll_mutex);
+         if (_view->idle_source)
+            g_source_remove(_view->idle_source);
+         for (auto id : _view->timer_sources)
+            g_source_remove(id);
+      }
+      stop_frames();
       delete _view;
    }
 
@@ -519,11 +656,19 @@ namespace cycfi { namespace elements
    {
       auto x = gtk_widget_get_allocated_width(_view->widget);
       auto y = gtk_widget_get_allocated_height(_view->widget);
-      refresh({ 0, 0, float(x), float(y) });
+      base_view::refresh({ 0, 0, float(x), float(y) });
    }
 
    void base_view::refresh(rect area)
    {
+      auto left = int(std::floor(area.left));
+      auto top = int(std::floor(area.top));
+      add_damage(_view, {
+         left, top
+       , int(std::ceil(area.right)) - left
+       , int(std::ceil(area.bottom)) - top
+      });
+
       gtk_widget_queue_draw_area(_view->widget,
          area.left,
          area.top,
@@ -532,6 +677,47 @@ namespace cycfi { namespace elements
       );
    }
 
+   void base_view::wake(std::chrono::steady_clock::duration delay)
+   {
+      std::lock_guard<std::mutex> lock(_view->poll_mutex);
+      if (delay <= delay.zero())
+      {
+         // One idle poll at a time is enough
+         if (!_view->idle_source)
+            _view->idle_source = g_idle_add(on_idle_poll, this);
+         return;
+      }
+
+      // Round up so that the timers due by then have expired when we poll
+      using namespace std::chrono;
+      auto ms = duration_cast<milliseconds>(delay + milliseconds(1)).count();
+      auto* timer = new poll_timer{ this, 0 };
+      timer->id = g_timeout_add_full(
+         G_PRIORITY_DEFAULT, guint(ms), on_timer_poll, timer, delete_poll_timer);
+      _view->timer_sources.push_back(timer->id);
+   }
+
+   bool base_view::start_frames()
+   {
+      if (!_view->widget)
+         return false;
+      if (!_view->tick_callback)
+      {
+         _view->tick_callback = gtk_widget_add_tick_callback(
+            _view->widget, on_frame, this, nullptr);
+      }
+      return true;
+   }
+
+   void base_view::stop_frames()
+   {
+      if (_view->tick_callback)
+      {
+         gtk_widget_remove_tick_callback(_view->widget, _view->tick_callback);
+         _view->tick_callback = 0;
+      }
+   }
+
    std::string clipboard()
    {
       GtkClipboard* clip = gtk_clipboard_get(GDK_SELECTION_CLIPBOARD);
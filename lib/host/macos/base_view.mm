@@ -654,6 +654,20 @@ namespace cycfi { namespace elements
       ];
    }
 
+   void base_view::wake(std::chrono::steady_clock::duration /* delay */)
+   {
+      // We poll on a timer (see on_tick)
+   }
+
+   bool base_view::start_frames()
+   {
+      return false;
+   }
+
+   void base_view::stop_frames()
+   {
+   }
+
    std::string clipboard()
    {
       NSPasteboard* pasteboard = [NSPasteboard generalPasteboard];
@@ -613,6 +613,20 @@ namespace cycfi { namespace elements
       InvalidateRect(_view, &r, false);
    }
 
+   void base_view::wake(std::chrono::steady_clock::duration /* delay */)
+   {
+      // We poll on a timer (see IDT_TIMER1)
+   }
+
+   bool base_view::start_frames()
+   {
+      return false;
+   }
+
+   void base_view::stop_frames()
+   {
+   }
+
    float base_view::hdpi_scale() const
    {
       return get_scale_for_window(_view);
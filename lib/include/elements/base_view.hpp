@@ -7,6 +7,7 @@
 #define CYCFI_ELEMENTS_BASE_VIEW_AUGUST_20_2016
 
 #include <utility>
+#include <chrono>
 #include <memory>
 #include <string>
 #include <cstdint>
@@ -311,10 +312,22 @@ namespace cycfi { namespace elements
       virtual void         begin_focus();
       virtual void         end_focus();
       virtual void         poll();
+      virtual void         frame();
 
       virtual void         refresh();
       virtual void         refresh(rect area);
 
+                           // Ask the host to call poll() when idle, or
+                           // after the given delay. Safe to call from any
+                           // thread. Hosts that poll on a timer ignore it.
+      void                 wake(std::chrono::steady_clock::duration delay = {});
+
+                           // Ask the host to call frame() once per display
+                           // frame until stop_frames(). Returns false if the
+                           // host has no frame clock.
+      bool                 start_frames();
+      void                 stop_frames();
+
       float                hdpi_scale() const;
       point                cursor_pos() const;
       extent               size() const;
@@ -337,6 +350,7 @@ namespace cycfi { namespace elements
    inline void base_view::begin_focus() {}
    inline void base_view::end_focus() {}
    inline void base_view::poll() {}
+   inline void base_view::frame() {}
 
    ////////////////////////////////////////////////////////////////////////////
    // The clipboard
@@ -0,0 +1,60 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_CACHED_OCTOBER_18_2026)
+#define ELEMENTS_CACHED_OCTOBER_18_2026
+
+#include <elements/element/proxy.hpp>
+#include <elements/support/pixmap.hpp>
+#include <infra/support.hpp>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // Cached elements
+   //
+   // A proxy that renders its subject into a pixmap, at the device scale,
+   // and draws the pixmap instead of the subject until the cache is
+   // invalidated. This is for subtrees that are expensive to draw but
+   // rarely change, such as themed panels.
+   //
+   // The cache is invalidated when the bounds of the element change size
+   // (or move, if the subject was partially outside the view), when the
+   // focus changes, when an element in the subject asks the view to
+   // refresh it (by element or by context), or when invalidate() is
+   // called. Input events by themselves do not invalidate the cache. Call
+   // invalidate() if the subject changes by any other means, e.g. if it
+   // refreshes a rect of the view.
+   ////////////////////////////////////////////////////////////////////////////
+   class cached_element_base : public proxy_base
+   {
+   public:
+
+      void                    draw(context const& ctx) override;
+      void                    begin_focus() override;
+      void                    end_focus() override;
+      void                    on_child_refresh() override;
+
+      void                    invalidate();
+
+   private:
+
+      void                    render(context const& ctx, float scale);
+
+      pixmap_ptr              _pixmap;
+      rect                    _bounds;
+      float                   _scale = 1;
+      bool                    _complete = false;   // subject was fully in view
+   };
+
+   template <typename Subject>
+   inline proxy<remove_cvref_t<Subject>, cached_element_base>
+   cached(Subject&& subject)
+   {
+      return { std::forward<Subject>(subject) };
+   }
+}}
+
+#endif
@@ -80,6 +80,19 @@ namespace cycfi { namespace elements
       virtual rect            bounds_of(context const& ctx, std::size_t index) const = 0;
       virtual bool            reverse_index() const { return false; }
 
+                              // The indices [first, last) of the elements
+                              // that may intersect area (or touch its edges).
+                              // Composites that lay out their elements in
+                              // order along an axis find these with a binary
+                              // search. All of them, by default.
+      struct index_range
+      {
+         std::size_t          first;
+         std::size_t          last;
+      };
+
+      virtual index_range     elements_in(context const& ctx, rect area) const;
+
                               template <typename F>
       void                    for_each(F&& f, bool reverse = false) const;
 
@@ -7,6 +7,7 @@
 #define ELEMENTS_DYNAMIC_MARCH_2_2020
 
 #include <elements/element/element.hpp>
+#include <elements/support/detail/self_handle.hpp>
 #include <memory>
 #include <vector>
 #include <functional>
@@ -15,6 +16,7 @@
 
 namespace cycfi { namespace elements
 {
+   class port_base;
 
    ////////////////////////////////////////////////////////////////////////////
    // The cell composer abstract class
@@ -34,6 +36,22 @@ namespace cycfi { namespace elements
       virtual element_ptr     compose(std::size_t index) = 0;
       virtual limits		  secondary_axis_limits(basic_context const& ctx) const = 0;
       virtual float			  main_axis_size(std::size_t index, basic_context const& ctx) const = 0;
+
+                              // Composers whose cells are expensive to
+                              // measure may give an estimate of the main
+                              // axis size of all cells instead. The list
+                              // then calls main_axis_size only for the cells
+                              // it draws. A negative estimate (the default)
+                              // means all cells are measured up front.
+      virtual float           estimated_main_axis_size(basic_context const& /* ctx */) const { return -1; }
+
+                              // Called with an element composed for index
+                              // that the list no longer needs (e.g. it was
+                              // scrolled out of view). Composers that can
+                              // rebind elements to other indices may keep
+                              // it for reuse by compose. By default, it is
+                              // simply released.
+      virtual void            recycle(std::size_t /* index */, element_ptr /* e */) {}
    };
 
    ////////////////////////////////////////////////////////////////////////////
@@ -154,6 +172,35 @@ namespace cycfi { namespace elements
       F                       _compose;
    };
 
+   ////////////////////////////////////////////////////////////////////////////
+   // This cell composer composes the cell element using a provided function
+   // that can reuse the elements recycled by the list. The function is
+   // given the index and a recycled element (or nullptr if there is none),
+   // and returns the element for the index: the recycled element rebound to
+   // the index, if it can, or a new one.
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename F, typename Base = cell_composer>
+   class recycling_function_cell_composer : public Base
+   {
+   public:
+
+                              template <typename... Rest>
+                              recycling_function_cell_composer(F&& compose_, Rest&& ...rest)
+                               : Base(std::forward<Rest>(rest)...)
+                               , _compose(compose_)
+                              {}
+
+      element_ptr             compose(std::size_t index) override;
+      void                    recycle(std::size_t index, element_ptr e) override;
+
+   private:
+
+      static constexpr std::size_t max_pool_size = 256;
+
+      F                       _compose;
+      std::vector<element_ptr> _pool;
+   };
+
    ////////////////////////////////////////////////////////////////////////////
    // basic_cell_composer given the number of elements and a compose function
    ////////////////////////////////////////////////////////////////////////////
@@ -189,6 +236,24 @@ namespace cycfi { namespace elements
       return share(return_type{ size, std::forward<ftype>(compose) });
    }
 
+   ////////////////////////////////////////////////////////////////////////////
+   // recycling_cell_composer given the number of elements and a compose
+   // function taking an index and a recycled element (see
+   // recycling_function_cell_composer).
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename F>
+   inline auto recycling_cell_composer(std::size_t size, F&& compose)
+   {
+      using ftype = remove_cvref_t<F>;
+      using return_type =
+         vertical_fixed_derived_limits_cell_composer<
+            fixed_length_cell_composer<
+               recycling_function_cell_composer<ftype>
+            >
+         >;
+      return share(return_type{ size, std::forward<ftype>(compose) });
+   }
+
    ////////////////////////////////////////////////////////////////////////////
    // basic_cell_composer given the min_width, line_height, number of
    // elements and a compose function.
@@ -280,6 +345,25 @@ namespace cycfi { namespace elements
       virtual void            	 reset();
       void 						 resize(size_t n);
 
+                                 // Tell the list about changes in the
+                                 // composer's cells without rebuilding it:
+                                 // count cells inserted before index, count
+                                 // cells erased from index, a cell moved
+                                 // from one index to another, or a cell that
+                                 // needs to be composed and measured again.
+                                 // Other cells keep their elements.
+      void                       insert(std::size_t index, std::size_t count = 1);
+      void                       erase(std::size_t index, std::size_t count = 1);
+      void                       move(std::size_t from, std::size_t to);
+      void                       invalidate(std::size_t index);
+
+                                 // The number of cells before and after the
+                                 // visible ones that keep their elements.
+                                 // Those further away give them back to the
+                                 // composer for recycling.
+      std::size_t                resident_margin() const { return _resident_margin; }
+      void                       resident_margin(std::size_t n) { _resident_margin = n; }
+
        struct hit_info
        {
           element_ptr            element;
@@ -298,6 +382,7 @@ namespace cycfi { namespace elements
          double                  main_axis_size;
          element_ptr             elem_ptr;
          int                     layout_id = -1;
+         bool                    measured = true;   // false if main_axis_size is an estimate
       };
 
       // virtual methods to specialize in hdynamic or vdynamic
@@ -305,6 +390,27 @@ namespace cycfi { namespace elements
       virtual float 	  		 get_main_axis_start(const rect &r);
       virtual float 	  	     get_main_axis_end(const rect &r);
       virtual void 	  			 make_bounds(context& ctx, float main_axis_start, cell_info &info);
+      virtual double             get_main_axis_align(port_base const& port) const;
+      virtual void               set_main_axis_align(port_base& port, double val) const;
+
+      // get_main_axis_start and get_main_axis_end, for the const members
+      float                      main_axis_start(rect const& r) const;
+      float                      main_axis_end(rect const& r) const;
+
+      void                       release_cells(std::size_t first, std::size_t last);
+      bool                       is_pinned(std::size_t ix) const;
+      void                       unpin_cell(int ix);
+      element_ptr                cell_element(std::size_t ix);
+      void                       update_positions(basic_context const& ctx) const;
+      std::size_t                find_cell(double pos) const;
+      void                       resolve_positions(std::size_t last) const;
+      double                     measure_cells(context const& ctx, rect area);
+      void                       keep_scroll_position(context const& ctx, double delta);
+      void                       relayout_cells(std::size_t first, std::size_t last);
+                                 template <typename F>
+      void                       remap_indices(F f);
+                                 template <typename F>
+      int                        find_resident(F f) const;
 
       using cells_vector = std::vector<cell_info>;
       mutable cells_vector        _cells;
@@ -315,16 +421,32 @@ namespace cycfi { namespace elements
       point                      _previous_size;
       std::size_t                _previous_window_start = 0;
       std::size_t                _previous_window_end = 0;
+      std::size_t                _resident_start = 0;
+      std::size_t                _resident_end = 0;
+      std::size_t                _resident_margin = 32;
 
       mutable double 			 _main_axis_full_size = 0;
       mutable int                _layout_id = 0;
       mutable bool               _update_request = true;
 
+      // Cells from this index on need their positions recomputed (and those
+      // with a negative main_axis_size, measured). npos if none does.
+      static constexpr std::size_t npos = std::size_t(-1);
+      mutable std::size_t        _dirty_from = npos;
+      mutable float              _estimated_size = -1;
+
+      // Cells from _shift_from on are _shift away from their recorded
+      // positions (see measure_cells).
+      mutable std::size_t        _shift_from = npos;
+      mutable double             _shift = 0;
+
       int 					   	 _focus = -1;
       int 					     _saved_focus = -1;
       int                        _click_tracking = -1;
       int                        _cursor_tracking = -1;
       std::set<int>           	 _cursor_hovering;
+
+      detail::self_handle<dynamic_list> _self;
    };
 
    ////////////////////////////////////////////////////////////////////////////
@@ -344,6 +466,8 @@ namespace cycfi { namespace elements
    protected:
       view_limits 				 make_limits(float main_axis_size, cell_composer::limits secondary_axis_limits) const override;
       void 						 make_bounds(context &ctx, float main_axis_start, cell_info &info) override;
+      double                     get_main_axis_align(port_base const& port) const override;
+      void                       set_main_axis_align(port_base& port, double val) const override;
       float 					 get_main_axis_start(const rect&r) override;
       float 					 get_main_axis_end(const rect &r) override;
 
@@ -352,6 +476,16 @@ namespace cycfi { namespace elements
    ////////////////////////////////////////////////////////////////////////////
    // Inlines
    ////////////////////////////////////////////////////////////////////////////
+   inline float dynamic_list::main_axis_start(rect const& r) const
+   {
+      return const_cast<dynamic_list*>(this)->get_main_axis_start(r);
+   }
+
+   inline float dynamic_list::main_axis_end(rect const& r) const
+   {
+      return const_cast<dynamic_list*>(this)->get_main_axis_end(r);
+   }
+
    template <typename Base>
    template <typename... Rest>
    inline static_limits_cell_composer<Base>::static_limits_cell_composer(
@@ -390,6 +524,26 @@ namespace cycfi { namespace elements
       return _main_axis_size;
    }
 
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename F, typename Base>
+   inline element_ptr recycling_function_cell_composer<F, Base>::compose(std::size_t index)
+   {
+      element_ptr recycled;
+      if (!_pool.empty())
+      {
+         recycled = std::move(_pool.back());
+         _pool.pop_back();
+      }
+      return _compose(index, std::move(recycled));
+   }
+
+   template <typename F, typename Base>
+   inline void recycling_function_cell_composer<F, Base>::recycle(std::size_t /* index */, element_ptr e)
+   {
+      if (e && _pool.size() < max_pool_size)
+         _pool.push_back(std::move(e));
+   }
+
    ////////////////////////////////////////////////////////////////////////////
    template <typename Base>
    template <typename... Rest>
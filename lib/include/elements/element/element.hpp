@@ -11,6 +11,7 @@
 #include <elements/support/rect.hpp>
 
 #include <infra/string_view.hpp>
+#include <cstddef>
 #include <memory>
 #include <type_traits>
 
@@ -42,6 +43,7 @@ namespace cycfi { namespace elements
       virtual void            layout(context const& ctx);
       virtual void            refresh(context const& ctx, element& element, int outward = 0);
       void                    refresh(context const& ctx, int outward = 0) { refresh(ctx, *this, outward); }
+      virtual void            on_child_refresh();
 
    // Control
 
@@ -67,6 +69,37 @@ namespace cycfi { namespace elements
       void                    on_tracking(view& view_, tracking state);
    };
 
+   ////////////////////////////////////////////////////////////////////////////
+   // Elements call invalidate_limits(*this) when a change in their content
+   // may change their limits. The views the element is in re-evaluate the
+   // limits of their element tree (see view::limits_generation). If no view
+   // drew the element yet, all of them do.
+   ////////////////////////////////////////////////////////////////////////////
+   void                       invalidate_limits(element const& e);
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Containers keep a layout_state to skip their relayout if it is still
+   // current: their bounds are the same as in their last layout, and
+   // nothing changed since. That is, no element in the view called
+   // invalidate_limits and the view was not asked to lay out the container,
+   // or an element in it (see view::layout(element&)).
+   ////////////////////////////////////////////////////////////////////////////
+   class layout_state
+   {
+   public:
+
+      bool                    is_current(context const& ctx, element const& e) const;
+      void                    update(context const& ctx);
+      void                    reset()           { _generation = no_generation; }
+
+   private:
+
+      static constexpr auto   no_generation = std::size_t(-1);
+
+      rect                    _bounds;
+      std::size_t             _generation = no_generation;
+   };
+
    ////////////////////////////////////////////////////////////////////////////
    using element_ptr = std::shared_ptr<element>;
    using element_const_ptr = std::shared_ptr<element const>;
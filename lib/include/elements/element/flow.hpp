@@ -25,6 +25,15 @@ namespace cycfi { namespace elements
                                , float width
                               );
 
+                              // Stores the end of each row in breaks, which
+                              // must have room for size()+1 rows. Returns the
+                              // number of rows.
+      std::size_t             break_lines(
+                                 basic_context const& ctx
+                               , float width
+                               , std::size_t* breaks
+                              );
+
       virtual float           width_of(size_t index, basic_context const& ctx) const;
       virtual element_ptr     make_row(size_t first, size_t last);
 
@@ -56,6 +65,7 @@ namespace cycfi { namespace elements
    private:
 
       flowable_container&     _flowable;
+      std::vector<std::size_t> _breaks;         // of our rows
    };
 
    inline auto flow(flowable_container& flowable_)
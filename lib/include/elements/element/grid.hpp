@@ -78,6 +78,7 @@ namespace cycfi { namespace elements
       view_limits             limits(basic_context const& ctx) const override;
       void                    layout(context const& ctx) override;
       rect                    bounds_of(context const& ctx, std::size_t index) const override;
+      index_range             elements_in(context const& ctx, rect area) const override;
       std::size_t             num_spans() const override { return _num_spans; }
 
    private:
@@ -127,6 +128,7 @@ namespace cycfi { namespace elements
       view_limits             limits(basic_context const& ctx) const override;
       void                    layout(context const& ctx) override;
       rect                    bounds_of(context const& ctx, std::size_t index) const override;
+      index_range             elements_in(context const& ctx, rect area) const override;
       std::size_t             num_spans() const override { return _num_spans; }
 
    private:
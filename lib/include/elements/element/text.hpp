@@ -7,10 +7,14 @@
 #define ELEMENTS_TEXT_APRIL_17_2016
 
 #include <elements/support/glyphs.hpp>
+#include <elements/support/text_storage.hpp>
 #include <elements/support/theme.hpp>
 #include <elements/element/element.hpp>
+#include <elements/support/detail/self_handle.hpp>
 
 #include <infra/string_view.hpp>
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -53,29 +57,114 @@ namespace cycfi { namespace elements
                                , color color_      = get_theme().text_box_font_color
                               );
 
+                              static_text_box(
+                                 text_storage_ptr text
+                               , font font_        = get_theme().text_box_font
+                               , float size        = get_theme().text_box_font_size
+                               , color color_      = get_theme().text_box_font_color
+                              );
+
                               static_text_box(static_text_box&& rhs) = default;
+                              ~static_text_box();
 
       view_limits             limits(basic_context const& ctx) const override;
       void                    layout(context const& ctx) override;
       void                    draw(context const& ctx) override;
 
-      std::string const&      get_text() const override            { return _text; }
+      std::string const&      get_text() const override;
       void                    set_text(string_view text) override;
 
-      std::string const&      value() const override           { return _text; }
+      std::string const&      value() const override           { return get_text(); }
       void                    value(string_view val) override;
 
+                              // Texts of at least this many bytes are shaped
+                              // on a worker thread. Until that is done, the
+                              // text box shows its previous text. Zero, the
+                              // default, disables it.
+      std::size_t             async_layout_threshold() const   { return _async_threshold; }
+      void                    async_layout_threshold(std::size_t bytes) { _async_threshold = bytes; }
+      bool                    layout_pending() const           { return bool(_layout_job); }
+
+   protected:
+
+      // The text is segmented into paragraphs, each with its own shaped
+      // glyphs. Every paragraph, except the first, starts with a newline.
+      // Edits re-shape only the paragraphs they touch. Line breaking is
+      // lazy: only the paragraphs [0, _num_broken) have rows. The number
+      // of rows of the rest is estimated.
+      struct paragraph
+      {
+         master_glyphs        layout;
+         std::size_t          first_row = 0;    // index of its first row in _rows
+         std::size_t          num_rows = 0;     // estimated, if not yet broken
+      };
+
+      using paragraphs = std::vector<paragraph>;
+
+      void                    replace_text(std::size_t pos, std::size_t len, string_view str);
+      void                    finish_layout();
+      void                    break_rows(context const& ctx, std::size_t num_rows_);
+      void                    break_rows(context const& ctx, char const* s);
+      std::size_t             num_rows() const     { return _rows.size() + _pending_rows; }
+      float                   line_height() const;
+
    private:
 
-      void                    sync() const;
+      void                    sync();
+      char const*             paragraph_begin(std::size_t i) const;
+      char const*             paragraph_end(std::size_t i) const;
+      void                    settle(std::size_t last);
+      static bool             split_paragraphs(
+                                 char const* first, char const* last
+                               , master_glyphs const& source
+                               , std::size_t chunk_size
+                               , paragraphs& out
+                               , std::atomic<bool> const* cancelled = nullptr
+                              );
+      std::size_t             estimate_rows(paragraph const& para) const;
+      void                    reset_rows();
+      void                    truncate_rows(std::size_t para_index);
+      void                    break_next();
+      void                    size_changed(context const& ctx);
 
    protected:
 
-      std::string             _text;
-      mutable master_glyphs   _layout;
+      // The glyphs point into the text and the selection is an offset into
+      // it. The text is shaped chunk by chunk, as the storage sizes them.
+      text_storage_ptr        _text;
+      master_glyphs           _layout;          // empty run: holds the font
+      paragraphs              _paragraphs;
+      std::size_t             _num_broken = 0;
+      std::size_t             _pending_rows = 0;
       std::vector<glyphs>     _rows;
       color                   _color;
       point                   _current_size = { -1, -1 };
+
+   private:
+
+      // An edit moves the text of all the paragraphs after it. We rebase
+      // those lazily (see settle): the paragraphs from _shift_from on still
+      // point into the text as it was at _shift_base, _shift bytes off.
+      static constexpr auto   no_shift = std::size_t(-1);
+
+      std::size_t             _shift_from = no_shift;
+      char const*             _shift_base = nullptr;
+      std::ptrdiff_t          _shift = 0;
+
+      detail::self_handle<static_text_box> _self;
+
+      // A text shaped on a worker thread (see async_layout_threshold). The
+      // job is started by layout or draw, where we have the view to post
+      // the result to.
+      struct layout_job;
+      using layout_job_ptr = std::shared_ptr<layout_job>;
+
+      void                    start_layout(context const& ctx);
+      void                    cancel_layout();
+      void                    adopt_layout();
+
+      layout_job_ptr          _layout_job;
+      std::size_t             _async_threshold = 0;
    };
 
    ////////////////////////////////////////////////////////////////////////////
@@ -89,6 +178,13 @@ namespace cycfi { namespace elements
                                , font font_        = get_theme().text_box_font
                                , float size        = get_theme().text_box_font_size
                               );
+
+                              basic_text_box(
+                                 text_storage_ptr text
+                               , font font_        = get_theme().text_box_font
+                               , float size        = get_theme().text_box_font_size
+                              );
+
                               ~basic_text_box();
                               basic_text_box(basic_text_box&& rhs) = default;
 
@@ -123,6 +219,7 @@ namespace cycfi { namespace elements
    protected:
 
       void                    scroll_into_view(context const& ctx, bool save_x);
+      void                    replace_text(std::size_t pos, std::size_t len, string_view str);
       virtual void            delete_(bool forward);
       virtual void            cut(view& v, int start, int end);
       virtual void            copy(view& v, int start, int end);
@@ -141,10 +238,16 @@ namespace cycfi { namespace elements
       char const*             caret_position(context const& ctx, point p);
       glyph_metrics           glyph_info(context const& ctx, char const* s);
 
-      struct state_saver;
-      using state_saver_f = std::function<void()>;
+      // Undo records keep only the changes an edit made to the text. All
+      // the changes between begin_edit and end_edit are undone together,
+      // as are consecutive text entries (typing).
+      // set_text starts a new generation of the text: the records of the
+      // previous ones do nothing when they are undone or redone.
+      struct edit_record;
+      using edit_record_ptr = std::shared_ptr<edit_record>;
 
-      state_saver_f           capture_state();
+      void                    begin_edit(context const& ctx);
+      void                    end_edit(context const& ctx);
 
       using this_handle = std::shared_ptr<basic_text_box*>;
       using this_weak_handle = std::weak_ptr<basic_text_box*>;
@@ -152,7 +255,9 @@ namespace cycfi { namespace elements
       int                     _select_start;
       int                     _select_end;
       float                   _current_x;
-      state_saver_f           _typing_state;
+      edit_record_ptr         _edit;
+      std::size_t             _generation = 0;
+      bool                    _typing : 1;
       bool                    _is_focus : 1;
       bool                    _show_caret : 1;
       bool                    _caret_started : 1;
@@ -11,6 +11,15 @@
 
 namespace cycfi { namespace elements
 {
+   namespace detail
+   {
+      // The limits and stretch of an element along the axis of its tile
+      struct tile_limits
+      {
+         float                min, max, stretch;
+      };
+   }
+
    ////////////////////////////////////////////////////////////////////////////
    // Vertical Tiles
    ////////////////////////////////////////////////////////////////////////////
@@ -22,10 +31,21 @@ namespace cycfi { namespace elements
       void                    draw(context const& ctx) override;
       void                    layout(context const& ctx) override;
       rect                    bounds_of(context const& ctx, std::size_t index) const override;
+      index_range             elements_in(context const& ctx, rect area) const override;
+
+   protected:
+
+                              // Call this if the elements were replaced
+      void                    invalidate_layout()    { _layout.reset(); }
 
    private:
 
+      layout_state            _layout;
       std::vector<float>      _tiles;
+
+      // As of the last allocation
+      float                   _space = -1;
+      std::vector<detail::tile_limits> _limits;
    };
 
    using vtile_composite = vector_composite<vtile_element>;
@@ -51,10 +71,16 @@ namespace cycfi { namespace elements
       void                    draw(context const& ctx) override;
       void                    layout(context const& ctx) override;
       rect                    bounds_of(context const& ctx, std::size_t index) const override;
+      index_range             elements_in(context const& ctx, rect area) const override;
 
    private:
 
+      layout_state            _layout;
       std::vector<float>      _tiles;
+
+      // As of the last allocation
+      float                   _space = -1;
+      std::vector<detail::tile_limits> _limits;
    };
 
    using htile_composite = vector_composite<htile_element>;
@@ -0,0 +1,192 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_DETAIL_BOUNDS_INDEX_OCTOBER_18_2026)
+#define ELEMENTS_DETAIL_BOUNDS_INDEX_OCTOBER_18_2026
+
+#include <elements/support/rect.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace cycfi { namespace elements
+{
+   class element;
+
+   namespace detail
+   {
+      /////////////////////////////////////////////////////////////////////////
+      // The bounds of the elements a view drew, and the element each was
+      // drawn in (its parent). An element drawn in more than one place has
+      // an entry for each of its parents. The entries are also kept in a
+      // coarse grid over the extent of the view, so that those in an area
+      // are found without looking at all of them.
+      /////////////////////////////////////////////////////////////////////////
+      class bounds_index
+      {
+      public:
+
+         void                 record(element const* e, element const* parent, rect bounds);
+         void                 erase(rect area);
+         void                 clear();
+         void                 extent(rect area);
+         bool                 contains(element const* e) const;
+
+                              // for_each F signature:
+                              // void f(element const* parent, rect bounds);
+                              template <typename F>
+         void                 for_each(element const* e, F f) const;
+
+      private:
+
+         static constexpr float cell_size = 128;
+
+         struct placement
+         {
+            element const*    parent;
+            rect              bounds;
+         };
+
+         using key = std::pair<element const*, element const*>;
+         using placements = std::vector<placement>;
+         using cell = std::vector<key>;
+
+         template <typename F>
+         void                 for_each_cell(rect bounds, F f);
+         void                 unlink(key k, rect bounds);
+
+         std::unordered_map<element const*, placements>  _entries;
+         std::unordered_map<std::uint64_t, cell>         _cells;
+         rect                 _extent;
+      };
+
+      /////////////////////////////////////////////////////////////////////////
+      // Inlines
+      /////////////////////////////////////////////////////////////////////////
+      template <typename F>
+      inline void bounds_index::for_each_cell(rect bounds, F f)
+      {
+         // Only the part in our extent. Areas outside it are never drawn.
+         if (!intersects(bounds, _extent))
+            return;
+         bounds = min(bounds, _extent);
+
+         auto to_cell = [](float pos) { return std::int32_t(std::floor(pos / cell_size)); };
+         auto left = to_cell(bounds.left), right = to_cell(bounds.right);
+         auto top = to_cell(bounds.top), bottom = to_cell(bounds.bottom);
+         for (auto y = top; y <= bottom; ++y)
+         {
+            for (auto x = left; x <= right; ++x)
+               f((std::uint64_t(std::uint32_t(y)) << 32) | std::uint32_t(x));
+         }
+      }
+
+      inline void bounds_index::unlink(key k, rect bounds)
+      {
+         for_each_cell(bounds,
+            [&](std::uint64_t id)
+            {
+               auto i = _cells.find(id);
+               if (i == _cells.end())
+                  return;
+               auto& c = i->second;
+               c.erase(std::remove(c.begin(), c.end(), k), c.end());
+               if (c.empty())
+                  _cells.erase(i);
+            }
+         );
+      }
+
+      inline void bounds_index::record(element const* e, element const* parent, rect bounds)
+      {
+         auto& list = _entries[e];
+         auto i = std::find_if(list.begin(), list.end(),
+            [parent](auto const& p) { return p.parent == parent; });
+
+         if (i == list.end())
+         {
+            list.push_back({ parent, bounds });
+         }
+         else
+         {
+            if (i->bounds == bounds)
+               return;
+            unlink({ e, parent }, i->bounds);
+            i->bounds = bounds;
+         }
+         for_each_cell(bounds, [&](std::uint64_t id) { _cells[id].push_back({ e, parent }); });
+      }
+
+      inline void bounds_index::erase(rect area)
+      {
+         // Erase the entries that intersect area. Only the cells of the area
+         // can have them.
+         std::vector<key> found;
+         for_each_cell(area,
+            [&](std::uint64_t id)
+            {
+               auto i = _cells.find(id);
+               if (i != _cells.end())
+                  found.insert(found.end(), i->second.begin(), i->second.end());
+            }
+         );
+
+         std::sort(found.begin(), found.end(), std::less<key>{});
+         found.erase(std::unique(found.begin(), found.end()), found.end());
+         for (auto k : found)
+         {
+            auto i = _entries.find(k.first);
+            if (i == _entries.end())
+               continue;
+            auto& list = i->second;
+            auto j = std::find_if(list.begin(), list.end(),
+               [&](auto const& p) { return p.parent == k.second; });
+            if (j == list.end() || !intersects(j->bounds, area))
+               continue;
+
+            unlink(k, j->bounds);
+            list.erase(j);
+            if (list.empty())
+               _entries.erase(i);
+         }
+      }
+
+      inline void bounds_index::clear()
+      {
+         _entries.clear();
+         _cells.clear();
+      }
+
+      inline void bounds_index::extent(rect area)
+      {
+         if (area != _extent)
+         {
+            clear();
+            _extent = area;
+         }
+      }
+
+      inline bool bounds_index::contains(element const* e) const
+      {
+         return _entries.find(e) != _entries.end();
+      }
+
+      template <typename F>
+      inline void bounds_index::for_each(element const* e, F f) const
+      {
+         auto i = _entries.find(e);
+         if (i == _entries.end())
+            return;
+         for (auto const& p : i->second)
+            f(p.parent, p.bounds);
+      }
+   }
+}}
+
+#endif
@@ -0,0 +1,112 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_DETAIL_SCRATCH_ARENA_OCTOBER_18_2026)
+#define ELEMENTS_DETAIL_SCRATCH_ARENA_OCTOBER_18_2026
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace cycfi { namespace elements { namespace detail
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // A bump allocator for temporary arrays, such as those of a layout pass.
+   // The arrays are all freed at once by reset, which keeps the memory:
+   // once the arena has grown to what a pass needs, allocating is just a
+   // pointer bump. Only for trivially destructible types.
+   ////////////////////////////////////////////////////////////////////////////
+   class scratch_arena
+   {
+   public:
+                              scratch_arena() = default;
+                              scratch_arena(scratch_arena const&) = delete;
+      scratch_arena&          operator=(scratch_arena const&) = delete;
+
+                              template <typename T>
+      T*                      allocate(std::size_t n);
+      void                    reset();
+
+   private:
+
+      static constexpr std::size_t min_block_size = 4096;
+
+      struct block
+      {
+         std::unique_ptr<std::max_align_t[]> data;
+         std::size_t          size;
+      };
+
+      static block            make_block(std::size_t size);
+      void*                   allocate_bytes(std::size_t size, std::size_t align);
+
+      std::vector<block>      _blocks;
+      std::size_t             _current = 0;  // the block we allocate from
+      std::size_t             _used = 0;     // bytes used in that block
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Inlines
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename T>
+   inline T* scratch_arena::allocate(std::size_t n)
+   {
+      static_assert(std::is_trivially_destructible<T>::value,
+         "scratch_arena does not destruct what it allocates");
+      static_assert(alignof(T) <= alignof(std::max_align_t),
+         "over-aligned types are not supported");
+
+      auto p = static_cast<T*>(allocate_bytes(n * sizeof(T), alignof(T)));
+      std::uninitialized_default_construct_n(p, n);
+      return p;
+   }
+
+   inline void scratch_arena::reset()
+   {
+      // If the last pass took more than one block, replace them with one
+      // that fits them all, so that the next pass needs no new block.
+      if (_blocks.size() > 1)
+      {
+         std::size_t total = 0;
+         for (auto const& b : _blocks)
+            total += b.size;
+         _blocks.clear();
+         _blocks.push_back(make_block(total));
+      }
+      _current = 0;
+      _used = 0;
+   }
+
+   inline scratch_arena::block scratch_arena::make_block(std::size_t size)
+   {
+      auto n = (size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+      return { std::unique_ptr<std::max_align_t[]>(new std::max_align_t[n]), n * sizeof(std::max_align_t) };
+   }
+
+   inline void* scratch_arena::allocate_bytes(std::size_t size, std::size_t align)
+   {
+      for (; _current != _blocks.size(); ++_current, _used = 0)
+      {
+         auto& b = _blocks[_current];
+         auto offset = (_used + align - 1) / align * align;
+         if (offset + size <= b.size)
+         {
+            _used = offset + size;
+            return reinterpret_cast<char*>(b.data.get()) + offset;
+         }
+      }
+
+      // Add a block, at least twice as large as the last
+      auto size_ = std::max(size, _blocks.empty()? min_block_size : _blocks.back().size * 2);
+      _blocks.push_back(make_block(size_));
+      _current = _blocks.size() - 1;
+      _used = size;
+      return _blocks.back().data.get();
+   }
+}}}
+
+#endif
@@ -14,6 +14,8 @@ namespace cycfi { namespace elements { namespace detail
    {
    public:
 
+      class scope;
+
       scratch_context()
       {
          _surface = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, nullptr);
@@ -32,8 +34,62 @@ namespace cycfi { namespace elements { namespace detail
 
       scratch_context(scratch_context const&) = delete;
 
+      // The recording surface keeps all that is drawn to it. A scratch
+      // context used over and over again starts over with a new one every
+      // so many uses (see scope).
+      static constexpr int max_uses = 256;
+
+      void              renew()
+      {
+         cairo_destroy(_context);
+         cairo_surface_destroy(_surface);
+         _surface = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, nullptr);
+         _context = cairo_create(_surface);
+      }
+
       cairo_surface_t*  _surface;
       cairo_t*          _context;
+      int               _depth = 0;
+      int               _uses = 0;
+   };
+
+   // A use of a scratch_context, starting from a clean state. The previous
+   // state is restored when the scope ends, even by an exception, so that
+   // scopes may nest (e.g. a layout from within an event handler).
+   class scratch_context::scope
+   {
+   public:
+
+      explicit scope(scratch_context& scratch)
+       : _scratch(scratch)
+      {
+         if (_scratch._depth++ == 0 && ++_scratch._uses == max_uses)
+         {
+            _scratch.renew();
+            _scratch._uses = 0;
+         }
+
+         _context = _scratch.context();
+         cairo_save(_context);
+         cairo_identity_matrix(_context);
+         cairo_reset_clip(_context);
+         cairo_new_path(_context);
+      }
+
+      ~scope()
+      {
+         cairo_restore(_context);
+         --_scratch._depth;
+      }
+
+      cairo_t*          context() const { return _context; }
+
+   private:
+
+      scope(scope const&) = delete;
+
+      scratch_context&  _scratch;
+      cairo_t*          _context;
    };
 }}}
 
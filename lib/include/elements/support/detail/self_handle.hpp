@@ -0,0 +1,50 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_DETAIL_SELF_HANDLE_OCTOBER_18_2026)
+#define ELEMENTS_DETAIL_SELF_HANDLE_OCTOBER_18_2026
+
+#include <memory>
+
+namespace cycfi { namespace elements { namespace detail
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // A handle to an object, for work posted to the view to find out if the
+   // object is still there when it runs. Unlike weak_from_this, it works
+   // for elements held by value too. The handle is not taken along when
+   // its object is copied or moved: the object it is in keeps its own.
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename T>
+   class self_handle
+   {
+   public:
+                              self_handle() = default;
+                              self_handle(self_handle const&) {}
+                              self_handle(self_handle&&) {}
+      self_handle&            operator=(self_handle const&) { return *this; }
+      self_handle&            operator=(self_handle&&) { return *this; }
+
+      using weak_type = std::weak_ptr<T*>;
+
+      weak_type               get(T* self);
+
+   private:
+
+      std::shared_ptr<T*>     _ptr;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Inlines
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename T>
+   inline typename self_handle<T>::weak_type self_handle<T>::get(T* self)
+   {
+      if (!_ptr)
+         _ptr = std::make_shared<T*>(self);
+      return _ptr;
+   }
+}}}
+
+#endif
@@ -11,6 +11,7 @@
 #include <elements/support/canvas.hpp>
 #include <elements/support/text_utils.hpp>
 #include <cairo.h>
+#include <atomic>
 #include <vector>
 #include <stdexcept>
 #include <string>
@@ -45,6 +46,10 @@ namespace cycfi { namespace elements
       char const*          begin() const     { return _first; }
       char const*          end() const       { return _last; }
 
+                           // Relocate the text pointers after the underlying
+                           // string moved from `from` to `to`.
+      void                 rebase(char const* from, char const* to);
+
       struct font_metrics
       {
          float             ascent;
@@ -69,7 +74,8 @@ namespace cycfi { namespace elements
       int                  _glyph_count   = 0;
       cluster*             _clusters      = nullptr;
       int                  _cluster_count = 0;
-      cluster_flags        _clusterflags;
+      cluster_flags        _clusterflags  = cluster_flags(0);
+      float const*         _advances      = nullptr;  // x-advance per glyph
    };
 
    ////////////////////////////////////////////////////////////////////////////
@@ -94,6 +100,18 @@ namespace cycfi { namespace elements
                             , point start = { 0, 0 }
                            );
 
+                           // Shapes [first, last) chunk by chunk, each at
+                           // most chunk_size bytes (see next_utf8_chunk).
+                           // Shaping stops, leaving no glyphs, as soon as
+                           // cancelled is set.
+                           master_glyphs(
+                              char const* first, char const* last
+                            , master_glyphs const& source
+                            , std::size_t chunk_size
+                            , std::atomic<bool> const* cancelled = nullptr
+                            , point start = { 0, 0 }
+                           );
+
                            master_glyphs(
                               string_view str
                             , font font_, float size
@@ -132,9 +150,28 @@ namespace cycfi { namespace elements
                            master_glyphs(master_glyphs const&) = delete;
       master_glyphs&       operator=(master_glyphs const& rhs) = delete;
 
-      void                 build(point start = { 0, 0 });
+      static constexpr auto whole = std::size_t(-1);
+
+      void                 build(
+                              point start = { 0, 0 }
+                            , std::size_t chunk_size = whole
+                            , std::atomic<bool> const* cancelled = nullptr
+                           );
+      void                 clear();
+
+      std::vector<float>   _advance_table;
    };
 
+   ////////////////////////////////////////////////////////////////////////////
+   // The shaped-run cache: master_glyphs keeps recently shaped runs (glyph
+   // and cluster arrays keyed by the text and the scaled font) in a shared,
+   // thread-safe LRU cache bounded by size in bytes. Set the capacity to
+   // zero to disable caching.
+   ////////////////////////////////////////////////////////////////////////////
+   std::size_t             shaped_run_cache_capacity();
+   void                    shaped_run_cache_capacity(std::size_t bytes);
+   void                    clear_shaped_run_cache();
+
    ////////////////////////////////////////////////////////////////////////////
    inline master_glyphs::master_glyphs(
       string_view str
@@ -178,12 +215,19 @@ namespace cycfi { namespace elements
       text(str.data(), str.data() + str.size(), start);
    }
 
+   inline void glyphs::rebase(char const* from, char const* to)
+   {
+      _first = to + (_first - from);
+      _last = to + (_last - from);
+   }
+
    template <typename F>
    inline void glyphs::for_each(F f)
    {
       CYCFI_ASSERT(_scaled_font, "Precondition failure: _scaled_font must not be null");
       CYCFI_ASSERT(_glyphs, "Precondition failure: _glyphs must not be null");
       CYCFI_ASSERT(_clusters, "Precondition failure: _clusters must not be null");
+      CYCFI_ASSERT(_advances, "Precondition failure: _advances must not be null");
 
       if (_first == _last)
          return;
@@ -196,11 +240,9 @@ namespace cycfi { namespace elements
       {
          cairo_text_cluster_t* cluster = _clusters + i;
          cairo_glyph_t* glyph = _glyphs + glyph_index;
-         cairo_text_extents_t extents;
-         cairo_scaled_font_glyph_extents(_scaled_font, glyph, 1, &extents);
 
          float x = glyph->x - start_x;
-         if (!f(_first + byte_index, x, x + extents.x_advance))
+         if (!f(_first + byte_index, x, x + _advances[glyph_index]))
             break;
 
          // glyph/byte position
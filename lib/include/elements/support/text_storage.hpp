@@ -0,0 +1,81 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(ELEMENTS_TEXT_STORAGE_OCTOBER_18_2026)
+#define ELEMENTS_TEXT_STORAGE_OCTOBER_18_2026
+
+#include <infra/string_view.hpp>
+#include <memory>
+#include <string>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // text_storage: Where a text box keeps its text. The glyphs of the text
+   // box point into the text, so a storage keeps it in one piece (str).
+   // What a storage decides is how the text is edited, and the size of the
+   // chunks it is shaped in (see master_glyphs). string_storage, the
+   // default, keeps the text in a std::string.
+   ////////////////////////////////////////////////////////////////////////////
+   class text_storage
+   {
+   public:
+
+      static constexpr std::size_t default_chunk_size = 16 * 1024;
+
+      virtual                    ~text_storage() = default;
+
+      virtual std::string const& str() const = 0;
+      virtual void               assign(std::string text) = 0;
+      virtual void               replace(std::size_t pos, std::size_t len, string_view text) = 0;
+      virtual std::size_t        chunk_size() const   { return default_chunk_size; }
+
+      char const*                data() const         { return str().data(); }
+      std::size_t                size() const         { return str().size(); }
+      bool                       empty() const        { return str().empty(); }
+      std::string                substr(std::size_t pos, std::size_t len) const;
+   };
+
+   using text_storage_ptr = std::unique_ptr<text_storage>;
+
+   ////////////////////////////////////////////////////////////////////////////
+   class string_storage : public text_storage
+   {
+   public:
+                                 string_storage(std::string text = "")
+                                  : _text(std::move(text))
+                                 {}
+
+      std::string const&         str() const override { return _text; }
+      void                       assign(std::string text) override;
+      void                       replace(std::size_t pos, std::size_t len, string_view text) override;
+
+   private:
+
+      std::string                _text;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Inlines
+   ////////////////////////////////////////////////////////////////////////////
+   inline std::string text_storage::substr(std::size_t pos, std::size_t len) const
+   {
+      return str().substr(pos, len);
+   }
+
+   inline void string_storage::assign(std::string text)
+   {
+      // Moving the text keeps its buffer (unless it is short enough to be
+      // stored in place)
+      _text = std::move(text);
+   }
+
+   inline void string_storage::replace(std::size_t pos, std::size_t len, string_view text)
+   {
+      _text.replace(pos, len, text.data(), text.size());
+   }
+}}
+
+#endif
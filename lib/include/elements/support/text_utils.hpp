@@ -25,6 +25,7 @@ namespace cycfi { namespace elements
    unsigned       decode_utf8(unsigned& state, unsigned& codepoint, unsigned byte);
    char const*    next_utf8(char const* last, char const* utf8);
    char const*    prev_utf8(char const* start, char const* utf8);
+   char const*    next_utf8_chunk(char const* first, char const* last, std::size_t size);
    unsigned       codepoint(char const*& utf8);
 
    ////////////////////////////////////////////////////////////////////////////
@@ -160,6 +161,31 @@ namespace cycfi { namespace elements
       return utf8;
    }
 
+   ////////////////////////////////////////////////////////////////////////////
+   // Chunking UTF8: Returns the end of the chunk of [first, last) that starts
+   // at first. The chunk is at most size bytes long (unless its first code
+   // point is longer) and does not split a code point. It ends after a
+   // space if there is one in its second half.
+   ////////////////////////////////////////////////////////////////////////////
+   inline char const* next_utf8_chunk(char const* first, char const* last, std::size_t size)
+   {
+      if (std::size_t(last - first) <= size)
+         return last;
+
+      auto end = first + size;
+      while (end != first && (uint8_t(*end) & 0xC0) == 0x80)
+         --end;
+      if (end == first)
+         return next_utf8(last, first);
+
+      for (auto i = end; std::size_t(i - first) > size / 2; --i)
+      {
+         if (i[-1] == ' ' || i[-1] == '\t' || i[-1] == '\n')
+            return i;
+      }
+      return end;
+   }
+
    ////////////////////////////////////////////////////////////////////////////
    // Extracting codepoints from UTF8
    ////////////////////////////////////////////////////////////////////////////
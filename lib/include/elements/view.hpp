@@ -14,11 +14,19 @@
 #include <elements/element/layer.hpp>
 #include <elements/element/size.hpp>
 #include <elements/element/indirect.hpp>
+#include <elements/support/detail/bounds_index.hpp>
+#include <elements/support/detail/scratch_arena.hpp>
+#include <elements/support/detail/scratch_context.hpp>
 #include <asio.hpp>
 #include <memory>
 #include <unordered_map>
 #include <chrono>
+#include <deque>
 #include <map>
+#include <mutex>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 namespace cycfi { namespace elements
 {
@@ -44,9 +52,21 @@ namespace cycfi { namespace elements
       void                    begin_focus() override;
       void                    end_focus() override;
       void                    poll() override;
+      void                    frame() override;
 
+                              // layout(element) lays out only the element and
+                              // the containers it is in, after a change to it.
+                              // The others keep their layout if their bounds
+                              // are unchanged (see layout_state).
       void                    layout();
       void                    layout(element& element);
+      bool                    is_layout_dirty(element const& e) const;
+
+                              // Temporary arrays for layouts. They are freed
+                              // at the start of each layout pass, and of each
+                              // draw.
+      using scratch_arena = detail::scratch_arena;
+      scratch_arena&          layout_arena()         { return _layout_arena; }
       float                   scale() const;
       void                    scale(float val);
 
@@ -60,6 +80,7 @@ namespace cycfi { namespace elements
       {
          std::function<void()> undo;
          std::function<void()> redo;
+         std::size_t          size = 0;   // memory held by the task, in bytes
       };
 
       void                    add_undo(undo_redo_task t);
@@ -68,6 +89,12 @@ namespace cycfi { namespace elements
       bool                    undo();
       bool                    redo();
 
+                              // The oldest undo tasks are dropped when the
+                              // undo and redo stacks hold more than this.
+      std::size_t             undo_memory_limit() const;
+      void                    undo_memory_limit(std::size_t bytes);
+      std::size_t             undo_memory() const;
+
       using content_type = layer_composite;
       using layers_type = layer_composite::container_type;
       using scaled_content = scale_element<indirect<reference<layer_composite>>>;
@@ -92,12 +119,46 @@ namespace cycfi { namespace elements
       layers_vector const&    layers() const;
 
       view_limits             limits() const;
+      std::size_t             limits_evaluations() const;
+
+                              // The limits generation changes when an
+                              // element in the view may have changed its
+                              // limits (see invalidate_limits).
+      std::size_t             limits_generation() const;
+      void                    invalidate_limits();
       mouse_button            current_button() const;
 
       using change_limits_function = std::function<void(view_limits limits_)>;
       change_limits_function on_change_limits;
 
-      using io_context = asio::io_context;
+      // The view's execution context. Its handlers are called from the UI
+      // thread when the host polls the view. Everything that queues one
+      // wakes the host (see base_view::wake): post, dispatch and defer on
+      // its executor, and the completions of the timers (and other I/O
+      // objects) made from it. asio waits for those on a thread of its
+      // own, which hands the completions to us as they are due.
+      class io_context : public asio::execution_context
+      {
+      public:
+
+         class executor_type;
+
+                              io_context(base_view& view_);
+                              ~io_context();
+
+         executor_type        get_executor() noexcept;
+         std::size_t          poll();
+         void                 stop();
+
+      private:
+
+         using ready_work = asio::executor_work_guard<asio::io_context::executor_type>;
+
+         base_view&           _view;
+         asio::io_context     _ready;     // the handlers for poll
+         ready_work           _work;
+      };
+
       io_context&             io();
 
                               template <typename T, typename F>
@@ -113,6 +174,19 @@ namespace cycfi { namespace elements
 
       void                    manage_on_tracking(element& e, tracking state);
 
+      // Animations are ticked once per display frame, all of them, and
+      // their refreshes are flushed together. An animation is ticked until
+      // it returns false. Call animate from the UI thread.
+      using animate_function = std::function<bool(std::chrono::steady_clock::time_point now)>;
+
+      void                    animate(animate_function f);
+      bool                    is_animating() const;
+
+                              // Containers record the bounds of the elements
+                              // they draw so that refresh(element&) can find
+                              // them without searching the element tree.
+      void                    record_bounds(context const& ctx);
+
    private:
 
       scaled_content          make_scaled_content() { return elements::scale(1.0, link(_content)); }
@@ -120,25 +194,87 @@ namespace cycfi { namespace elements
       layer_composite         _content;
       scaled_content          _main_element;
 
-      void                    set_limits();
+      void                    set_limits(bool force = false);
+
+      // A persistent measuring context for the contexts we build outside
+      // of draw (events, layout, limits). See scratch_context::scope.
+                              template <typename F>
+      void                    call(F f);
+
+      detail::scratch_context _scratch;
+      scratch_arena           _layout_arena;
 
       rect                    _dirty;
       rect                    _current_bounds;
       view_limits             _current_limits = { { 0, 0 }, { full_extent, full_extent} };
+      std::size_t             _limits_generation = 1;
+      std::size_t             _limits_evaluated = 0;     // the generation of _current_limits
+      std::size_t             _limits_evaluations = 0;  // in the last frame
       mouse_button            _current_button;
       bool                    _is_focus = false;
 
-      using undo_stack_type = std::stack<undo_redo_task>;
+      using undo_stack_type = std::deque<undo_redo_task>;
+
+      void                    trim_undo();
+
       undo_stack_type         _undo_stack;
       undo_stack_type         _redo_stack;
+      std::size_t             _undo_memory = 0;
+      std::size_t             _undo_memory_limit = 16 * 1024 * 1024;
 
       io_context              _io;
-      io_context::work        _work;
 
       using time_point = std::chrono::steady_clock::time_point;
+      using duration = std::chrono::steady_clock::duration;
       using tracking_map = std::map<element*, time_point>;
 
+      // Elements that do not report again within a second stop tracking
+      void                    schedule_end_tracking(duration delay);
+      void                    end_tracking();
+
       tracking_map            _tracking;
+      asio::steady_timer      _tracking_timer;
+      bool                    _tracking_scheduled = false;
+
+      using animations = std::vector<animate_function>;
+
+      void                    tick_animations(time_point now);
+
+      animations              _animations;
+      animations              _new_animations;
+      time_point              _last_frame;
+      bool                    _animating = false;
+      bool                    _host_frames = false;   // the host has a frame clock
+
+      // Refresh requests are collected in a damage list and flushed to the
+      // host once per frame (see poll). Overlapping or nearby rects are
+      // coalesced and each element is refreshed once.
+      void                    flush_refresh();
+
+      using element_refresh = std::pair<element*, int>;
+      using element_refresh_list = std::vector<element_refresh>;
+
+      std::mutex              _refresh_mutex;
+      std::vector<rect>       _damage;
+      element_refresh_list    _element_refresh;
+      bool                    _refresh_all = false;
+
+      // The element bounds index: the device bounds of the elements, in
+      // each of the places they were drawn last.
+      using bounds_index = detail::bounds_index;
+
+      bool                    find_bounds(element const& e, int outward, std::vector<rect>& bounds) const;
+      bool                    mark_layout_dirty(element const& e);
+      bool                    is_layer(element const& e) const;
+
+      using element_set = std::unordered_set<element const*>;
+
+      bounds_index            _bounds_index;
+      element_set             _layout_dirty;    // in the current layout pass
+      cairo_t*                _draw_context = nullptr;
+      cairo_matrix_t          _device_matrix;   // host device to view device
+
+      friend void             invalidate_limits(element const& e);
    };
 
    ////////////////////////////////////////////////////////////////////////////
@@ -170,6 +306,16 @@ namespace cycfi { namespace elements
       return !_redo_stack.empty();
    }
 
+   inline std::size_t view::undo_memory_limit() const
+   {
+      return _undo_memory_limit;
+   }
+
+   inline std::size_t view::undo_memory() const
+   {
+      return _undo_memory;
+   }
+
    inline view::content_type& view::content()
    {
       return _content;
@@ -184,7 +330,7 @@ namespace cycfi { namespace elements
    {
       _content = list;
       std::reverse(_content.begin(), _content.end());
-      set_limits();
+      set_limits(true);
    }
 
    namespace detail
@@ -207,7 +353,7 @@ namespace cycfi { namespace elements
    {
       _content = { detail::add_element(std::forward<E>(elements))... };
       std::reverse(_content.begin(), _content.end());
-      set_limits();
+      set_limits(true);
    }
 
    inline void view::add(element_ptr e)
@@ -220,7 +366,7 @@ namespace cycfi { namespace elements
             || std::find(_content.begin(), _content.end(), e) != _content.end())
             return;
 
-         io().post(
+         post(
             [e, this]
             {
                end_focus();
@@ -240,7 +386,7 @@ namespace cycfi { namespace elements
       // post a function that is called at idle time.
       if (e)
       {
-         io().post(
+         post(
             [e, this]
             {
                auto i = std::find(_content.begin(), _content.end(), e);
@@ -268,7 +414,7 @@ namespace cycfi { namespace elements
    {
       if (e && _content.back() != e)
       {
-         io().post(
+         post(
             [e, this]
             {
                auto i = std::find(_content.begin(), _content.end(), e);
@@ -289,7 +435,7 @@ namespace cycfi { namespace elements
    {
       if (e && _content.front() != e)
       {
-         io().post(
+         post(
             [e, this]
             {
                auto i = std::find(_content.begin(), _content.end(), e);
@@ -316,11 +462,124 @@ namespace cycfi { namespace elements
       return _current_limits;
    }
 
+   // The number of times the limits of the element tree were evaluated
+   // while drawing the last frame. This is zero if nothing changed them.
+   inline std::size_t view::limits_evaluations() const
+   {
+      return _limits_evaluations;
+   }
+
+   inline std::size_t view::limits_generation() const
+   {
+      return _limits_generation;
+   }
+
+   inline void view::invalidate_limits()
+   {
+      ++_limits_generation;
+   }
+
    inline view::io_context& view::io()
    {
       return _io;
    }
 
+   class view::io_context::executor_type
+   {
+   public:
+                              executor_type(io_context& io_) noexcept
+                               : _io(&io_)
+                              {}
+
+                              template <typename F>
+      void                    execute(F&& f) const;
+
+      io_context&             query(asio::execution::context_t) const noexcept;
+      static constexpr asio::execution::blocking_t
+                              query(asio::execution::blocking_t) noexcept;
+      executor_type           require(asio::execution::blocking_t::never_t) const noexcept;
+
+      bool                    operator==(executor_type const& rhs) const noexcept;
+      bool                    operator!=(executor_type const& rhs) const noexcept;
+
+   private:
+
+      io_context*             _io;
+   };
+
+   inline view::io_context::io_context(base_view& view_)
+    : _view(view_)
+    , _work(asio::make_work_guard(_ready))
+   {}
+
+   inline view::io_context::~io_context()
+   {
+      // Stop asio's thread before the handlers it hands to us are gone
+      shutdown();
+      destroy();
+   }
+
+   inline view::io_context::executor_type view::io_context::get_executor() noexcept
+   {
+      return { *this };
+   }
+
+   inline std::size_t view::io_context::poll()
+   {
+      return _ready.poll();
+   }
+
+   inline void view::io_context::stop()
+   {
+      _ready.stop();
+   }
+
+   template <typename F>
+   inline void view::io_context::executor_type::execute(F&& f) const
+   {
+      // Called from any thread
+      asio::post(_io->_ready, std::forward<F>(f));
+      _io->_view.wake();
+   }
+
+   inline view::io_context&
+   view::io_context::executor_type::query(asio::execution::context_t) const noexcept
+   {
+      return *_io;
+   }
+
+   constexpr asio::execution::blocking_t
+   view::io_context::executor_type::query(asio::execution::blocking_t) noexcept
+   {
+      return asio::execution::blocking.never;
+   }
+
+   inline view::io_context::executor_type
+   view::io_context::executor_type::require(asio::execution::blocking_t::never_t) const noexcept
+   {
+      return *this;
+   }
+
+   inline bool view::io_context::executor_type::operator==(executor_type const& rhs) const noexcept
+   {
+      return _io == rhs._io;
+   }
+
+   inline bool view::io_context::executor_type::operator!=(executor_type const& rhs) const noexcept
+   {
+      return _io != rhs._io;
+   }
+
+   inline bool view::is_layout_dirty(element const& e) const
+   {
+      return _layout_dirty.find(&e) != _layout_dirty.end();
+   }
+
+   inline bool view::is_animating() const
+   {
+      return _animating;
+   }
+
    inline mouse_button view::current_button() const
    {
       return _current_button;
@@ -343,7 +602,7 @@ namespace cycfi { namespace elements
    template <typename F>
    inline void view::post(F f)
    {
-      _io.post(f);
+      asio::post(_io, std::move(f));
    }
 }}
 
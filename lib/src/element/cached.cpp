@@ -0,0 +1,96 @@
+/*=============================================================================
+   Copyright (c) 2016-2020 Joel de Guzman
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <elements/element/cached.hpp>
+#include <elements/support/context.hpp>
+#include <elements/view.hpp>
+#include <cmath>
+#include <memory>
+
+namespace cycfi { namespace elements
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // cached_element_base class implementation
+   ////////////////////////////////////////////////////////////////////////////
+   void cached_element_base::draw(context const& ctx)
+   {
+      if (ctx.bounds.is_empty())
+         return;
+
+      // The device scale includes the view's hdpi scale and zoom, as well
+      // as the scale of the target surface (e.g. the GTK host's)
+      auto  tl = ctx.canvas.user_to_device(ctx.bounds.top_left());
+      auto  br = ctx.canvas.user_to_device(ctx.bounds.bottom_right());
+      auto  scale = float(std::abs(br.x - tl.x) / ctx.bounds.width());
+
+      double sx, sy;
+      auto target = cairo_get_target(&ctx.canvas.cairo_context());
+      cairo_surface_get_device_scale(target, &sx, &sy);
+      scale *= float(sx);
+
+      if (_pixmap)
+      {
+         // If the subject was partially outside the view when we rendered
+         // it, the pixmap may be missing some parts of it.
+         auto moved = ctx.bounds.top_left() != _bounds.top_left();
+         if (ctx.bounds.size() != _bounds.size() || scale != _scale || (moved && !_complete))
+            invalidate();
+      }
+
+      if (!_pixmap)
+         render(ctx, scale);
+
+      ctx.canvas.draw(*_pixmap, rect{ 0, 0, ctx.bounds.size() }, ctx.bounds);
+   }
+
+   void cached_element_base::render(context const& ctx, float scale)
+   {
+      auto  size = ctx.bounds.size();
+      auto  pm = std::make_shared<pixmap>(
+         point{ std::ceil(size.x * scale), std::ceil(size.y * scale) }, 1 / scale
+      );
+      _bounds = ctx.bounds;
+      _scale = scale;
+      _complete = ctx.view_bounds().includes(ctx.bounds);
+
+      {
+         pixmap_context pm_ctx{ *pm };
+         canvas cnv{ *pm_ctx.context() };
+         cnv.translate({ -ctx.bounds.left, -ctx.bounds.top });
+
+         context sctx{ ctx.view, cnv, &subject(), ctx.bounds };
+         sctx.parent = &ctx;
+         prepare_subject(sctx);
+         subject().draw(sctx);
+         restore_subject(sctx);
+      }
+
+      // The subject may refresh itself while it draws (which invalidates
+      // us). What it drew is still current.
+      _pixmap = std::move(pm);
+   }
+
+   void cached_element_base::invalidate()
+   {
+      _pixmap.reset();
+   }
+
+   void cached_element_base::on_child_refresh()
+   {
+      invalidate();
+   }
+
+   void cached_element_base::begin_focus()
+   {
+      proxy_base::begin_focus();
+      invalidate();
+   }
+
+   void cached_element_base::end_focus()
+   {
+      proxy_base::end_focus();
+      invalidate();
+   }
+}}
@@ -24,13 +24,21 @@ namespace cycfi { namespace elements
 
    void composite_base::draw(context const& ctx)
    {
-      for (std::size_t ix = 0; ix < size(); ++ix)
+      // Only the elements in the clip area need drawing
+      auto area = ctx.view_bounds();
+      auto clip = ctx.canvas.clip_extent();
+      if (!intersects(area, clip))
+         return;
+      auto range = elements_in(ctx, min(area, clip));
+
+      for (auto ix = range.first; ix < range.last; ++ix)
       {
          rect bounds = bounds_of(ctx, ix);
          if (intersects(bounds, ctx.view_bounds()))
          {
             auto& e = at(ix);
             context ectx{ ctx, &e, bounds };
+            ctx.view.record_bounds(ectx);
             e.draw(ectx);
          }
       }
@@ -346,21 +354,27 @@ namespace cycfi { namespace elements
          };
 
       hit_info info = hit_info{ {}, rect{}, -1 };
+      auto range = elements_in(ctx, rect{ p.x, p.y, p.x, p.y });
       if (reverse_index())
       {
-         for (int ix = int(size())-1; ix >= 0; --ix)
+         for (int ix = int(range.last)-1; ix >= int(range.first); --ix)
             if (test_element(ix, info))
                break;
       }
       else
       {
-         for (std::size_t ix = 0; ix < size(); ++ix)
-            if (test_element(ix, info))
+         for (auto ix = range.first; ix < range.last; ++ix)
+            if (test_element(int(ix), info))
                break;
       }
       return info;
    }
 
+   composite_base::index_range composite_base::elements_in(context const& /* ctx */, rect /* area */) const
+   {
+      return { 0, size() };
+   }
+
    bool composite_base::wants_control() const
    {
       for (std::size_t ix = 0; ix < size(); ++ix)
@@ -4,7 +4,9 @@
    Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
 =============================================================================*/
 #include <elements/element/dynamic_list.hpp>
+#include <elements/element/port.hpp>
 #include <elements/view.hpp>
+#include <algorithm>
 
 namespace cycfi { namespace elements
 {
@@ -16,6 +18,7 @@ namespace cycfi { namespace elements
          {
             update(ctx);
          }
+         update_positions(ctx);
          auto secondary_limits = _composer->secondary_axis_limits(ctx);
          if (_composer->size())
          {
@@ -30,6 +33,7 @@ namespace cycfi { namespace elements
        // Johann Philippe : this seems to be necessary for context where a hdynamic_list is inside vdynamic_list (2D tables)
       if (_update_request)
            update(ctx);
+      update_positions(ctx);
 
       auto& cnv = ctx.canvas;
       auto  state = cnv.new_state();
@@ -39,19 +43,32 @@ namespace cycfi { namespace elements
       if (!intersects(ctx.bounds, clip_extent))
          return;
 
-      auto it = std::lower_bound(_cells.begin(), _cells.end(),
-         get_main_axis_start(clip_extent) - main_axis_start,
-         [](auto const& cell, double pivot)
+      if (_estimated_size >= 0)
+      {
+         // Our size changes as we replace estimates with actual sizes. Keep
+         // the cells we are drawing where they are, and relayout so that
+         // our containers (only them) follow.
+         if (auto delta = measure_cells(ctx, clip_extent))
          {
-            return (cell.pos + cell.main_axis_size) < pivot;
+            keep_scroll_position(ctx, delta);
+            ctx.view.post(
+               [wp = _self.get(this), &view = ctx.view]
+               {
+                  if (auto p = wp.lock())
+                     view.layout(**p);
+               }
+            );
          }
-      );
+      }
+
+      auto it = _cells.begin() + find_cell(get_main_axis_start(clip_extent) - main_axis_start);
 
       // Draw the rows within the visible bounds of the view
       std::size_t new_start = it - _cells.begin();
 
       for (; it != _cells.end(); ++it)
       {
+         resolve_positions((it - _cells.begin()) + 1);
          auto& cell = *it;
          context rctx { ctx, cell.elem_ptr.get(), ctx.bounds };
          make_bounds(rctx, main_axis_start, cell);
@@ -79,15 +96,27 @@ namespace cycfi { namespace elements
       // Cleanup old rows
       if (new_start != _previous_window_start || new_end != _previous_window_end)
       {
-         for (auto i = _previous_window_start; i != _previous_window_end; ++i)
+         auto end = std::min(_previous_window_end, _cells.size());
+         for (auto i = _previous_window_start; i < end; ++i)
          {
-            if ((i < new_start || i >= new_end) && i < _cells.size())
+            if (i < new_start || i >= new_end)
             {
                _cells[i].layout_id = -1;
             }
          }
       }
 
+      // Give back the elements of the cells that are too far out of view
+      auto resident_start = new_start > _resident_margin? new_start - _resident_margin : 0;
+      auto resident_end = std::min(new_end + _resident_margin, _cells.size());
+      if (resident_start != _resident_start || resident_end != _resident_end)
+      {
+         release_cells(_resident_start, std::min(_resident_end, resident_start));
+         release_cells(std::max(_resident_start, resident_end), _resident_end);
+         _resident_start = resident_start;
+         _resident_end = resident_end;
+      }
+
       _previous_window_start = new_start;
       _previous_window_end = new_end;
       _previous_size.x = ctx.bounds.width();
@@ -105,32 +134,374 @@ namespace cycfi { namespace elements
       }
    }
 
+   void dynamic_list::release_cells(std::size_t first, std::size_t last)
+   {
+      last = std::min(last, _cells.size());
+      for (auto i = first; i < last; ++i)
+      {
+         // The pinned cells keep their elements, along with their state
+         auto& cell = _cells[i];
+         if (cell.elem_ptr && !is_pinned(i))
+         {
+            _composer->recycle(i, std::move(cell.elem_ptr));
+            cell.elem_ptr = nullptr;
+            cell.layout_id = -1;
+         }
+      }
+   }
+
+   bool dynamic_list::is_pinned(std::size_t ix) const
+   {
+      // The focus and the cells tracking the mouse. Their elements are
+      // in the middle of something.
+      return int(ix) == _focus || int(ix) == _click_tracking
+         || _cursor_hovering.find(int(ix)) != _cursor_hovering.end();
+   }
+
+   void dynamic_list::unpin_cell(int ix)
+   {
+      // A cell that is no longer pinned gives back its element if it is
+      // not resident
+      if (ix != -1 && (std::size_t(ix) < _resident_start || std::size_t(ix) >= _resident_end))
+         release_cells(ix, ix + 1);
+   }
+
+   element_ptr dynamic_list::cell_element(std::size_t ix)
+   {
+      // The element of a cell we have composed already, along with its
+      // state. Otherwise, compose one, and keep it if the cell is resident
+      // or pinned.
+      auto& cell = _cells[ix];
+      if (cell.elem_ptr)
+         return cell.elem_ptr;
+      auto e = _composer->compose(ix);
+      if ((ix >= _resident_start && ix < _resident_end) || is_pinned(ix))
+      {
+         cell.elem_ptr = e;
+         cell.layout_id = -1;
+      }
+      return e;
+   }
+
    void dynamic_list::update()
    {
       _update_request = true;
+      release_cells(_resident_start, _resident_end);
+      _resident_start = _resident_end = 0;
       _cells.clear();
       _main_axis_full_size = 0;
+      invalidate_limits(*this);
    }
 
    void dynamic_list::update(basic_context const& ctx) const
    {
       if (_composer)
       {
+         _estimated_size = _composer->estimated_main_axis_size(ctx);
          if (auto size = _composer->size())
          {
             double y = 0;
             _cells.reserve(_composer->size());
-            for (std::size_t i = 0; i != size; ++i)
+            if (_estimated_size >= 0)
+            {
+               for (std::size_t i = 0; i != size; ++i)
+               {
+                  _cells.push_back({ y, _estimated_size, nullptr, -1, false });
+                  y += _estimated_size;
+               }
+            }
+            else
             {
-               auto main_axis_size = _composer->main_axis_size(i, ctx);
-               _cells.push_back({ y, main_axis_size, nullptr });
-               y += main_axis_size;
+               for (std::size_t i = 0; i != size; ++i)
+               {
+                  auto main_axis_size = _composer->main_axis_size(i, ctx);
+                  _cells.push_back({ y, main_axis_size, nullptr });
+                  y += main_axis_size;
+               }
             }
             _main_axis_full_size = y;
          }
       }
       ++_layout_id;
       _update_request = false;
+      _dirty_from = npos;
+      _shift_from = npos;
+      _shift = 0;
+   }
+
+   void dynamic_list::update_positions(basic_context const& ctx) const
+   {
+      if (_dirty_from == npos)
+         return;
+
+      auto first = std::min(_dirty_from, _cells.size());
+      resolve_positions(first);
+      double pos = 0;
+      if (first != 0)
+         pos = _cells[first-1].pos + _cells[first-1].main_axis_size;
+      for (auto i = first; i != _cells.size(); ++i)
+      {
+         auto& cell = _cells[i];
+         if (cell.main_axis_size < 0)
+         {
+            cell.measured = _estimated_size < 0;
+            cell.main_axis_size = cell.measured?
+               _composer->main_axis_size(i, ctx) : _estimated_size;
+         }
+         cell.pos = pos;
+         pos += cell.main_axis_size;
+      }
+      _main_axis_full_size = pos;
+      _dirty_from = npos;
+      _shift_from = npos;
+      _shift = 0;
+   }
+
+   std::size_t dynamic_list::find_cell(double pos) const
+   {
+      // The first cell that ends at or after pos. The cells with pending
+      // positions (see resolve_positions) are sorted too, only shifted.
+      auto end_before = [](auto const& cell, double pivot)
+         {
+            return (cell.pos + cell.main_axis_size) < pivot;
+         };
+      auto first = _cells.begin();
+      auto mid = first + std::min(_shift_from, _cells.size());
+      auto it = std::lower_bound(first, mid, pos, end_before);
+      if (it == mid)
+         it = std::lower_bound(mid, _cells.end(), pos - _shift, end_before);
+      return it - first;
+   }
+
+   void dynamic_list::resolve_positions(std::size_t last) const
+   {
+      // Apply the pending shift to the cells before last
+      last = std::min(last, _cells.size());
+      for (; _shift_from < last; ++_shift_from)
+         _cells[_shift_from].pos += _shift;
+      if (_shift_from >= _cells.size())
+      {
+         _shift_from = npos;
+         _shift = 0;
+      }
+   }
+
+   double dynamic_list::measure_cells(context const& ctx, rect area)
+   {
+      // Measure the cells in the area, moving each by the change in the
+      // sizes of those before it, so that the cells that move into the area
+      // get measured too. The cells before the area stay where they are.
+      // Moving the cells after the area is left for later: they are given
+      // a pending shift.
+      auto main_axis_start = get_main_axis_start(ctx.bounds);
+      auto from = get_main_axis_start(area) - main_axis_start;
+      auto to = get_main_axis_end(area) - main_axis_start;
+      double delta = 0;
+
+      auto i = find_cell(from);
+      for (; i != _cells.size(); ++i)
+      {
+         resolve_positions(i + 1);
+         auto& cell = _cells[i];
+         cell.pos += delta;
+         if (cell.pos > to)
+            break;
+
+         if (!cell.measured)
+         {
+            auto size = _composer->main_axis_size(i, ctx);
+            cell.measured = true;
+            if (size != cell.main_axis_size)
+            {
+               delta += size - cell.main_axis_size;
+               cell.main_axis_size = size;
+               cell.layout_id = -1;
+            }
+         }
+      }
+
+      if (delta != 0 && i != _cells.size())
+      {
+         // The cells after i are now pending, if they were not already
+         auto first = i + 1;
+         if (_shift_from == npos)
+            _shift = 0;
+         else
+            for (auto j = first; j < _shift_from; ++j)
+               _cells[j].pos -= _shift;
+         _shift_from = first;
+         _shift += delta;
+         if (first == _cells.size())
+            resolve_positions(first);
+      }
+      _main_axis_full_size += delta;
+      return delta;
+   }
+
+   void dynamic_list::keep_scroll_position(context const& ctx, double delta)
+   {
+      // Find the port (e.g. scroller) we are in, and the context of its
+      // subject
+      port_base* port = nullptr;
+      auto content = &ctx;
+      for (; content->parent; content = content->parent)
+      {
+         if ((port = dynamic_cast<port_base*>(content->parent->element)))
+            break;
+      }
+      if (!port)
+         return;
+
+      // The scroller positions its subject by aligning it. Keep the offset
+      // of the subject the same as its size changes by delta.
+      auto extent = [this](rect r) { return get_main_axis_end(r) - get_main_axis_start(r); };
+      double scroll = extent(content->bounds) - extent(content->parent->bounds);
+      double new_scroll = scroll + delta;
+      if (scroll > 0 && new_scroll > 0)
+      {
+         auto offset = scroll * get_main_axis_align(*port);
+         set_main_axis_align(*port, std::clamp(offset / new_scroll, 0.0, 1.0));
+      }
+   }
+
+   void dynamic_list::relayout_cells(std::size_t first, std::size_t last)
+   {
+      last = std::min(last, _cells.size());
+      for (auto i = first; i < last; ++i)
+         _cells[i].layout_id = -1;
+   }
+
+   template <typename F>
+   void dynamic_list::remap_indices(F f)
+   {
+      auto remap = [&](int& i) { if (i != -1) i = f(i); };
+      remap(_focus);
+      remap(_saved_focus);
+      remap(_click_tracking);
+      remap(_cursor_tracking);
+
+      std::set<int> hovering;
+      for (auto i : _cursor_hovering)
+         if ((i = f(i)) != -1)
+            hovering.insert(i);
+      _cursor_hovering.swap(hovering);
+
+      // The visible window is recomputed by the next draw
+      _previous_window_start = _resident_start;
+      _previous_window_end = _resident_end;
+   }
+
+   void dynamic_list::insert(std::size_t index, std::size_t count)
+   {
+      if (_update_request)
+      {
+         _composer->resize(_composer->size() + count);
+         return;
+      }
+
+      index = std::min(index, _cells.size());
+      _cells.insert(_cells.begin() + index, count, cell_info{ 0, -1, nullptr });
+      _composer->resize(_cells.size());
+
+      // An empty resident range at index stays where it is
+      if (_resident_start > index || (_resident_start == index && _resident_end > index))
+         _resident_start += count;
+      if (_resident_end > index)
+         _resident_end += count;
+      remap_indices([=](int i) { return std::size_t(i) >= index? int(i + count) : i; });
+      relayout_cells(index + count, _resident_end);
+
+      _dirty_from = std::min(_dirty_from, index);
+      invalidate_limits(*this);
+   }
+
+   void dynamic_list::erase(std::size_t index, std::size_t count)
+   {
+      if (_update_request)
+      {
+         _composer->resize(_composer->size() - std::min(count, _composer->size()));
+         return;
+      }
+
+      index = std::min(index, _cells.size());
+      count = std::min(count, _cells.size() - index);
+      auto end = index + count;
+
+      // The erased cells' elements are of no use, not even the focus'
+      if (_focus >= int(index) && _focus < int(end))
+         _focus = -1;
+      release_cells(index, end);
+      _cells.erase(_cells.begin() + index, _cells.begin() + end);
+      _composer->resize(_cells.size());
+
+      auto shift = [=](std::size_t i) { return i <= index? i : i < end? index : i - count; };
+      _resident_start = shift(_resident_start);
+      _resident_end = shift(_resident_end);
+      remap_indices(
+         [=](int i)
+         {
+            if (std::size_t(i) < index)
+               return i;
+            return std::size_t(i) < end? -1 : int(i - count);
+         }
+      );
+      relayout_cells(index, _resident_end);
+
+      _dirty_from = std::min(_dirty_from, index);
+      invalidate_limits(*this);
+   }
+
+   void dynamic_list::move(std::size_t from, std::size_t to)
+   {
+      if (_update_request || from >= _cells.size() || to >= _cells.size() || from == to)
+         return;
+
+      auto first = _cells.begin();
+      if (from < to)
+         std::rotate(first + from, first + from + 1, first + to + 1);
+      else
+         std::rotate(first + to, first + from, first + from + 1);
+
+      // The cells between from and to are shifted by one, so those that
+      // have elements are now at most one cell outside the resident range.
+      if (_resident_start > 0)
+         --_resident_start;
+      _resident_end = std::min(_resident_end + 1, _cells.size());
+      if (to < _resident_start || to >= _resident_end)
+         release_cells(to, to + 1);
+
+      remap_indices(
+         [=](int i_) -> int
+         {
+            auto i = std::size_t(i_);
+            if (i == from)
+               return int(to);
+            if (from < to && i > from && i <= to)
+               return i_ - 1;
+            if (to < from && i >= to && i < from)
+               return i_ + 1;
+            return i_;
+         }
+      );
+      relayout_cells(std::min(from, to), std::max(from, to) + 1);
+
+      _dirty_from = std::min(_dirty_from, std::min(from, to));
+   }
+
+   void dynamic_list::invalidate(std::size_t index)
+   {
+      if (_update_request || index >= _cells.size())
+         return;
+
+      auto& cell = _cells[index];
+      if (cell.elem_ptr)
+         _composer->recycle(index, std::move(cell.elem_ptr));
+      cell.elem_ptr = nullptr;
+      cell.layout_id = -1;
+      cell.main_axis_size = -1;
+
+      _dirty_from = std::min(_dirty_from, index);
+      invalidate_limits(*this);
    }
 
 
@@ -157,13 +528,15 @@ namespace cycfi { namespace elements
           }
           else if (_click_tracking != -1) // button up
           {
-             rect  bounds = bounds_of(ctx, _click_tracking);
-             auto& e = *_composer->compose(_click_tracking);
+             auto  tracking = _click_tracking;
+             rect  bounds = bounds_of(ctx, tracking);
+             auto  ptr = cell_element(tracking);
+             auto& e = *ptr;
              context ectx{ ctx, &e, bounds };
-             if (e.click(ectx, btn))
-             {
-                return true;
-             }
+             auto  r = e.click(ectx, btn);
+             _click_tracking = -1;
+             unpin_cell(tracking);
+             return r;
           }
        }
        _click_tracking = -1;
@@ -175,7 +548,8 @@ namespace cycfi { namespace elements
       if (_focus != -1)
       {
          rect  bounds = bounds_of(ctx, _focus);
-         auto& focus_ = *_cells[_focus].elem_ptr;
+         auto  ptr = cell_element(_focus);
+         auto& focus_ = *ptr;
          context ectx{ ctx, &focus_, bounds };
          return focus_.text(ectx, info);
       };
@@ -184,20 +558,23 @@ namespace cycfi { namespace elements
 
    void dynamic_list::new_focus(context const& ctx, int index)
    {
-       if (_focus != -1 )
+       auto prev = _focus;
+       if (prev != -1 && _cells[prev].elem_ptr != nullptr)
        {
-           _composer->compose(_focus)->end_focus();
+           _cells[prev].elem_ptr->end_focus();
            ctx.view.refresh(ctx);
        }
 
        // start a new focus
        _focus = index;
-       if (_focus != -1 && _cells[_focus].elem_ptr != nullptr)
-
+       if (_focus != -1)
        {
-           _cells[_focus].elem_ptr->begin_focus();
+           cell_element(_focus)->begin_focus();
            ctx.view.refresh(ctx);
        }
+
+       // The previous focus kept its element even if it was not resident
+       unpin_cell(prev);
    }
 
 
@@ -206,7 +583,8 @@ namespace cycfi { namespace elements
        auto&& try_key = [&](int ix) -> bool
        {
            rect bounds = bounds_of(ctx, ix);
-           auto& e = *_composer->compose(ix).get();
+           auto ptr = cell_element(ix);
+           auto& e = *ptr;
            context ectx{ ctx, &e, bounds };
            bool b = e.key(ectx, k);
            return b;
@@ -215,8 +593,11 @@ namespace cycfi { namespace elements
 
        auto&& try_focus = [&](int ix) -> bool
        {
-           if (_composer->compose(ix)->wants_focus())
+           auto e = cell_element(ix);
+           if (e->wants_focus())
            {
+               // Keep the element we asked: it is our focus now
+               _cells[ix].elem_ptr = e;
                new_focus(ctx, ix);
                return true;
            }
@@ -250,9 +631,8 @@ namespace cycfi { namespace elements
            {
                while (--next_focus >= 0)
                {
-                   if (_composer->compose(next_focus)->wants_focus())
-                       if (try_focus(next_focus))
-                           return true;
+                   if (try_focus(next_focus))
+                       return true;
                }
                return false;
            }
@@ -298,11 +678,16 @@ namespace cycfi { namespace elements
          {
             if (ix < int(_cells.size()))
             {
-               auto& e = *_composer->compose(ix).get();
+               auto ptr = cell_element(ix);
+               auto& e = *ptr;
                context ectx{ ctx, &e, bounds_of(ctx, ix) };
                e.cursor(ectx, p, cursor_tracking::leaving);
             }
          }
+         auto hovering = std::move(_cursor_hovering);
+         _cursor_hovering.clear();
+         for (auto ix : hovering)
+            unpin_cell(ix);
          return false;
       }
 
@@ -312,13 +697,16 @@ namespace cycfi { namespace elements
       {
          if (*i < int(_cells.size()))
          {
-            auto& e = *_composer->compose(*i).get();
+            auto  ptr = cell_element(*i);
+            auto& e = *ptr;
             rect  b = bounds_of(ctx, *i);
             context ectx{ ctx, &e, b };
             if (!b.includes(p) || !e.hit_test(ectx, p))
             {
                e.cursor(ectx, p, cursor_tracking::leaving);
+               auto ix = *i;
                i = _cursor_hovering.erase(i);
+               unpin_cell(ix);
                continue;
             }
          }
@@ -337,8 +725,8 @@ namespace cycfi { namespace elements
              status = cursor_tracking::entering;
             _cursor_hovering.insert(_cursor_tracking);
          }
-         auto& e = *_composer->compose(_cursor_tracking).get();
-         context ectx{ ctx, &e, bounds_of(ctx, _cursor_tracking) };
+         auto& e = *info.element;
+         context ectx{ ctx, &e, info.bounds };
          return e.cursor(ectx, p, status);
       }
 
@@ -350,7 +738,8 @@ namespace cycfi { namespace elements
        if (_click_tracking != -1)
        {
           rect  bounds = bounds_of(ctx, _click_tracking);
-          auto& e = *_composer->compose(_click_tracking).get();
+          auto  ptr = cell_element(_click_tracking);
+          auto& e = *ptr;
           context ectx{ ctx, &e, bounds };
           e.drag(ectx, btn);
        }
@@ -372,20 +761,28 @@ namespace cycfi { namespace elements
    }
 
 
+   template <typename F>
+   int dynamic_list::find_resident(F f) const
+   {
+      // Only the resident cells and the focus have elements
+      auto last = std::min(_resident_end, _cells.size());
+      for (auto ix = _resident_start; ix < last; ++ix)
+         if (_cells[ix].elem_ptr != nullptr && f(*_cells[ix].elem_ptr))
+            return int(ix);
+      if (_focus != -1 && std::size_t(_focus) < _cells.size()
+         && _cells[_focus].elem_ptr != nullptr && f(*_cells[_focus].elem_ptr))
+         return _focus;
+      return -1;
+   }
+
    bool dynamic_list::wants_focus() const
    {
-       for (std::size_t ix = 0; ix != _cells.size(); ++ix)
-           if (_cells[ix].elem_ptr != nullptr && _cells[ix].elem_ptr->wants_focus())
-               return true;
-       return false;
+       return find_resident([](element const& e) { return e.wants_focus(); }) != -1;
    }
 
    bool dynamic_list::wants_control() const
    {
-      for (std::size_t ix = 0; ix < _cells.size(); ++ix)
-         if (_cells[ix].elem_ptr != nullptr && _cells[ix].elem_ptr->wants_control())
-            return true;
-      return false;
+      return find_resident([](element const& e) { return e.wants_control(); }) != -1;
    }
 
    void dynamic_list::begin_focus()
@@ -393,14 +790,7 @@ namespace cycfi { namespace elements
        if (_focus == -1)
            _focus = _saved_focus;
        if (_focus == -1)
-       {
-           for (std::size_t ix = 0; ix != _cells.size(); ++ix)
-               if (_cells[ix].elem_ptr != nullptr && _cells[ix].elem_ptr->wants_focus())
-               {
-                   _focus = ix;
-                   break;
-               }
-       }
+           _focus = find_resident([](element const& e) { return e.wants_focus(); });
        if (_focus != -1 && _cells[_focus].elem_ptr != nullptr)
            _cells[_focus].elem_ptr->begin_focus();
    }
@@ -472,17 +862,31 @@ namespace cycfi { namespace elements
             return false;
          };
 
+      update_positions(ctx);
       hit_info info = hit_info{ {}, rect{}, -1 };
+
+      // The cells that include p: the first one that ends at or after it,
+      // and those after it that start at it
+      auto pos = main_axis_start(rect{ p.x, p.y, p.x, p.y }) - main_axis_start(ctx.bounds);
+      auto first = find_cell(pos);
+      auto last = first;
+      for (; last != _cells.size(); ++last)
+      {
+         resolve_positions(last + 1);
+         if (_cells[last].pos > pos)
+            break;
+      }
+
       if (reverse_index())
       {
-         for (int ix = int(_cells.size())-1; ix >= 0; --ix)
+         for (int ix = int(last)-1; ix >= int(first); --ix)
             if (test_element(ix, info))
                break;
       }
       else
       {
-         for (std::size_t ix = 0; ix < _cells.size(); ++ix)
-            if (test_element(ix, info))
+         for (auto ix = first; ix < last; ++ix)
+            if (test_element(int(ix), info))
                break;
       }
       return info;
@@ -510,8 +914,20 @@ namespace cycfi { namespace elements
        ctx.bounds.height(cell.main_axis_size);
    }
 
+   double dynamic_list::get_main_axis_align(port_base const& port) const
+   {
+       return port.valign();
+   }
+
+   void dynamic_list::set_main_axis_align(port_base& port, double val) const
+   {
+       port.valign(val);
+   }
+
    rect dynamic_list::bounds_of(context const& ctx, int ix) const
    {
+       update_positions(ctx);
+       resolve_positions(ix + 1);
        rect r = ctx.bounds;
        r.top = ctx.bounds.top + _cells[ix].pos;
        r.height(_cells[ix].main_axis_size);
@@ -541,8 +957,20 @@ namespace cycfi { namespace elements
        ctx.bounds.width(cell.main_axis_size);
    }
 
+   double hdynamic_list::get_main_axis_align(port_base const& port) const
+   {
+       return port.halign();
+   }
+
+   void hdynamic_list::set_main_axis_align(port_base& port, double val) const
+   {
+       port.halign(val);
+   }
+
    rect hdynamic_list::bounds_of(context const& ctx, int ix) const
    {
+       update_positions(ctx);
+       resolve_positions(ix + 1);
        rect r = ctx.bounds;
        r.left = ctx.bounds.left + _cells[ix].pos;
        r.width(_cells[ix].main_axis_size);
@@ -9,6 +9,21 @@
 
 namespace cycfi { namespace elements
 {
+   bool layout_state::is_current(context const& ctx, element const& e) const
+   {
+      return _generation == ctx.view.limits_generation()
+         && _bounds == ctx.bounds
+         && !ctx.view.is_layout_dirty(e)
+         && !(ctx.element && ctx.view.is_layout_dirty(*ctx.element))
+         ;
+   }
+
+   void layout_state::update(context const& ctx)
+   {
+      _bounds = ctx.bounds;
+      _generation = ctx.view.limits_generation();
+   }
+
    ////////////////////////////////////////////////////////////////////////////
    // element class implementation
    ////////////////////////////////////////////////////////////////////////////
@@ -46,6 +61,10 @@ namespace cycfi { namespace elements
          ctx.view.refresh(ctx, outward);
    }
 
+   void element::on_child_refresh()
+   {
+   }
+
    bool element::click(context const& /* ctx */, mouse_button /* btn */)
    {
       return false;
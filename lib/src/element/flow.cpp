@@ -6,6 +6,7 @@
 #include <elements/element/flow.hpp>
 #include <elements/support/context.hpp>
 #include <elements/view.hpp>
+#include <algorithm>
 
 namespace cycfi { namespace elements
 {
@@ -30,8 +31,24 @@ namespace cycfi { namespace elements
 
    void flow_element::layout(context const& ctx)
    {
-      clear();
-      _flowable.break_lines(*this, ctx, ctx.bounds.width());
+      // Make new rows only if the lines break differently from the last
+      // time, or the flowable changed. Our rows refer to the elements of
+      // the flowable by index, so they stay valid otherwise.
+      auto breaks = ctx.view.layout_arena().allocate<std::size_t>(_flowable.size()+1);
+      auto num_rows = _flowable.break_lines(ctx, ctx.bounds.width(), breaks);
+      if (_flowable.needs_reflow()
+         || !std::equal(breaks, breaks + num_rows, _breaks.begin(), _breaks.end()))
+      {
+         clear();
+         std::size_t first = 0;
+         for (auto i = breaks; i != breaks + num_rows; ++i)
+         {
+            push_back(_flowable.make_row(first, *i));
+            first = *i;
+         }
+         _breaks.assign(breaks, breaks + num_rows);
+         invalidate_layout();
+      }
       base_type::layout(ctx);
 
       if (_flowable.needs_reflow())
@@ -46,10 +63,28 @@ namespace cycfi { namespace elements
     , basic_context const& ctx
     , float width
    )
+   {
+      std::vector<std::size_t> breaks(size()+1);
+      auto num_rows = break_lines(ctx, width, breaks.data());
+
+      std::size_t first = 0;
+      for (std::size_t i = 0; i != num_rows; ++i)
+      {
+         rows.push_back(make_row(first, breaks[i]));
+         first = breaks[i];
+      }
+   }
+
+   std::size_t flowable_container::break_lines(
+      basic_context const& ctx
+    , float width
+    , std::size_t* breaks
+   )
    {
       double      curr_x = 0;
       std::size_t first = 0;
       std::size_t last = 0;
+      std::size_t num_rows = 0;
 
       for (std::size_t ix = 0; ix != size();  ++ix)
       {
@@ -59,7 +94,7 @@ namespace cycfi { namespace elements
          if (curr_x > width)
          {
             curr_x = elem_nat_x;
-            rows.push_back(make_row(first, last));
+            breaks[num_rows++] = last;
             first = last;
          }
 
@@ -67,7 +102,8 @@ namespace cycfi { namespace elements
       }
 
       if (first != last)
-         rows.push_back(make_row(first, last));
+         breaks[num_rows++] = last;
+      return num_rows;
    }
 
    float flowable_container::width_of(size_t index, basic_context const& ctx) const
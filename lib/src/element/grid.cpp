@@ -5,9 +5,24 @@
 =============================================================================*/
 #include <elements/element/grid.hpp>
 #include <elements/support/context.hpp>
+#include <algorithm>
 
 namespace cycfi { namespace elements
 {
+   namespace
+   {
+      // The elements that may overlap [from, to], given their positions:
+      // positions[i] is where element i starts, and positions[size] is
+      // where the last one ends.
+      composite_base::index_range positions_in(
+         std::vector<float> const& positions, float from, float to)
+      {
+         auto first = std::lower_bound(positions.begin() + 1, positions.end(), from) - (positions.begin() + 1);
+         auto last = std::upper_bound(positions.begin(), positions.end() - 1, to) - positions.begin();
+         return { std::size_t(first), std::size_t(last) };
+      }
+   }
+
    ////////////////////////////////////////////////////////////////////////////
    // Vertical Grids
    ////////////////////////////////////////////////////////////////////////////
@@ -67,6 +82,13 @@ namespace cycfi { namespace elements
       return { left, _positions[index], right, _positions[index+1] };
    }
 
+   vgrid_element::index_range vgrid_element::elements_in(context const& ctx, rect area) const
+   {
+      if (_positions.size() != size()+1)
+         return composite_base::elements_in(ctx, area);
+      return positions_in(_positions, area.top, area.bottom);
+   }
+
    ////////////////////////////////////////////////////////////////////////////
    // Horizontal Grids
    ////////////////////////////////////////////////////////////////////////////
@@ -125,4 +147,11 @@ namespace cycfi { namespace elements
       auto bottom = ctx.bounds.bottom;
       return { _positions[index], top, _positions[index+1], bottom };
    }
+
+   hgrid_element::index_range hgrid_element::elements_in(context const& ctx, rect area) const
+   {
+      if (_positions.size() != size()+1)
+         return composite_base::elements_in(ctx, area);
+      return positions_in(_positions, area.left, area.right);
+   }
 }}
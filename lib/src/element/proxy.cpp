@@ -40,6 +40,7 @@ namespace cycfi { namespace elements
    {
       context sctx { ctx, &subject(), ctx.bounds };
       prepare_subject(sctx);
+      ctx.view.record_bounds(sctx);
       subject().draw(sctx);
       restore_subject(sctx);
    }
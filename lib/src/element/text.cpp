@@ -9,6 +9,15 @@
 #include <elements/support/text_utils.hpp>
 #include <elements/support/context.hpp>
 #include <elements/view.hpp>
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
 #include <utility>
 
 namespace cycfi { namespace elements
@@ -23,18 +32,120 @@ namespace cycfi { namespace elements
     , font font_
     , float size
     , color color_
+   )
+    : static_text_box(std::make_unique<string_storage>(std::move(text)), font_, size, color_)
+   {}
+
+   static_text_box::static_text_box(
+      text_storage_ptr text
+    , font font_
+    , float size
+    , color color_
    )
     : _text(std::move(text))
-    , _layout(_text.data(), _text.data() + _text.size(), font_, size)
+    , _layout(_text->data(), _text->data(), font_, size)
     , _color(color_)
    {}
 
-   view_limits static_text_box::limits(basic_context const& /* ctx */) const
+   namespace
    {
-      sync();
+      // One thread shapes the texts of all the text boxes, one at a time
+      // (see static_text_box::start_layout)
+      class layout_worker
+      {
+      public:
 
-      auto  size = _layout.metrics();
-      auto  min_line_height = size.ascent + size.descent + size.leading;
+         layout_worker()
+          : _thread([this]{ run(); })
+         {}
+
+         ~layout_worker()
+         {
+            {
+               std::lock_guard<std::mutex> lock(_mutex);
+               _stop = true;
+            }
+            _ready.notify_one();
+            _thread.join();
+         }
+
+         void post(std::function<void()> f)
+         {
+            {
+               std::lock_guard<std::mutex> lock(_mutex);
+               _queue.push_back(std::move(f));
+            }
+            _ready.notify_one();
+         }
+
+      private:
+
+         void run()
+         {
+            while (true)
+            {
+               std::function<void()> f;
+               {
+                  std::unique_lock<std::mutex> lock(_mutex);
+                  _ready.wait(lock, [this]{ return _stop || !_queue.empty(); });
+                  if (_queue.empty())
+                     return;
+                  f = std::move(_queue.front());
+                  _queue.pop_front();
+               }
+               f();
+            }
+         }
+
+         std::mutex                          _mutex;
+         std::condition_variable             _ready;
+         std::deque<std::function<void()>>   _queue;
+         bool                                _stop = false;
+         std::thread                         _thread;
+      };
+
+      layout_worker& get_layout_worker()
+      {
+         static layout_worker worker;
+         return worker;
+      }
+   }
+
+   // A text shaped on the layout worker (see start_layout). The job is
+   // shared by the text box and the worker, and holds all the worker
+   // needs: the worker never touches the text box.
+   struct static_text_box::layout_job
+   {
+      layout_job(std::string text_, master_glyphs const& source_, std::size_t chunk_size_)
+       : text(std::move(text_))
+       , source(text.data(), text.data(), source_)
+       , chunk_size(chunk_size_)
+      {}
+
+      std::string             text;
+      master_glyphs           source;        // empty run: holds the font
+      std::size_t             chunk_size;
+      paragraphs              result;
+      std::exception_ptr      error;
+      bool                    posted = false;   // to the worker
+      bool                    adopted = false;  // by the text box
+      std::atomic<bool>       cancelled{ false };
+      std::atomic<bool>       done{ false };
+
+      // The worker and finish_layout take the job, whichever comes first
+      std::mutex              mutex;
+      std::condition_variable finished;
+      bool                    started = false;
+   };
+
+   static_text_box::~static_text_box()
+   {
+      cancel_layout();
+   }
+
+   view_limits static_text_box::limits(basic_context const& /* ctx */) const
+   {
+      auto  min_line_height = line_height();
       float line_height =
          (_current_size.y == -1) ?
          min_line_height :
@@ -49,64 +160,511 @@ namespace cycfi { namespace elements
 
    void static_text_box::layout(context const& ctx)
    {
+      start_layout(ctx);
       sync();
 
-      _rows.clear();
+      // Line breaking is lazy. Here, we only discard the rows if the width
+      // changed. The rows are broken as they are needed (see break_rows).
+      auto  prev_size = _current_size;
       auto  new_x = ctx.bounds.width();
-      _layout.break_lines(new_x, _rows);
-      auto  size = _layout.metrics();
-      auto  new_y = _rows.size() * (size.ascent + size.descent + size.leading);
+      if (new_x != _current_size.x)
+      {
+         _current_size.x = new_x;
+         reset_rows();
+      }
+
+      auto  new_y = num_rows() * line_height();
 
       // Refresh the union of the old and new bounds if the size has changed
-      if (_current_size.x != new_x || _current_size.y != new_y)
+      if (prev_size.x != new_x || prev_size.y != new_y)
       {
-         if (_current_size.x != -1 && _current_size.y != -1)
-            ctx.view.refresh(max(ctx.bounds, rect(ctx.bounds.top_left(), extent{_current_size})));
+         if (prev_size.x != -1 && prev_size.y != -1)
+            ctx.view.refresh(max(ctx.bounds, rect(ctx.bounds.top_left(), extent{prev_size})));
          else
             ctx.view.refresh(ctx.bounds);
       }
 
-      _current_size.x = new_x;
+      // Our height changed, e.g. by an edit. Our containers have to
+      // follow. This is not the case if our width did (they are laying
+      // us out).
+      if (prev_size.y != -1 && prev_size.x == new_x && prev_size.y != new_y)
+         size_changed(ctx);
+
       _current_size.y = new_y;
    }
 
    void static_text_box::draw(context const& ctx)
    {
+      start_layout(ctx);
+
       auto& cnv = ctx.canvas;
       auto  state = cnv.new_state();
       auto  metrics = _layout.metrics();
       auto  line_height = metrics.ascent + metrics.descent + metrics.leading;
-      auto  x = ctx.bounds.left;
-      auto  y = ctx.bounds.top + metrics.ascent;
       auto  clip_extent = cnv.clip_extent();
 
+      auto  top = std::max(clip_extent.top, ctx.bounds.top);
+      auto  bottom = std::min(clip_extent.bottom, ctx.bounds.bottom);
+      if (bottom <= top || line_height <= 0)
+         return;
+
+      // All rows have the same height, so the visible rows are found
+      // directly from the clip extent. Break the lines of the visible
+      // rows, and a page more, ahead of scrolling.
+      auto  first = std::size_t((top - ctx.bounds.top) / line_height);
+      auto  last = std::size_t(std::ceil((bottom - ctx.bounds.top) / line_height));
+      break_rows(ctx, last + (last - first));
+      last = std::min(last, _rows.size());
+
+      auto  x = ctx.bounds.left;
+      auto  y = ctx.bounds.top + metrics.ascent + (first * line_height);
+
       cnv.rect(ctx.bounds);
       cnv.clip();
       cnv.fill_style(_color);
-      for (auto& row : _rows)
+      for (auto i = first; i < last; ++i)
       {
-         if (y + metrics.descent > clip_extent.top)
-            row.draw({ x, y }, cnv);
+         _rows[i].draw({ x, y }, cnv);
          y += line_height;
-         if (y > ctx.bounds.bottom + metrics.ascent)
+      }
+   }
+
+   float static_text_box::line_height() const
+   {
+      auto  metrics = _layout.metrics();
+      return metrics.ascent + metrics.descent + metrics.leading;
+   }
+
+   void static_text_box::sync()
+   {
+      // Rebuild all the paragraphs if _text was changed behind our back
+      auto f = _text->data();
+      auto l = _text->data() + _text->size();
+      if (_paragraphs.empty()
+         || f != paragraph_begin(0)
+         || l != paragraph_end(_paragraphs.size()-1))
+      {
+         _paragraphs.clear();
+         _shift_from = no_shift;
+         split_paragraphs(f, l, _layout, _text->chunk_size(), _paragraphs);
+         reset_rows();
+      }
+   }
+
+   char const* static_text_box::paragraph_begin(std::size_t i) const
+   {
+      auto p = _paragraphs[i].layout.begin();
+      if (i < _shift_from)
+         return p;
+      return _text->data() + ((p - _shift_base) + _shift);
+   }
+
+   char const* static_text_box::paragraph_end(std::size_t i) const
+   {
+      auto p = _paragraphs[i].layout.end();
+      if (i < _shift_from)
+         return p;
+      return _text->data() + ((p - _shift_base) + _shift);
+   }
+
+   void static_text_box::settle(std::size_t last)
+   {
+      // Rebase the paragraphs before last
+      last = std::min(last, _paragraphs.size());
+      if (_shift_from >= last)
+         return;
+
+      auto to = _text->data() + _shift;
+      for (auto i = _shift_from; i != last; ++i)
+         _paragraphs[i].layout.rebase(_shift_base, to);
+
+      _shift_from = (last == _paragraphs.size())? no_shift : last;
+   }
+
+   bool static_text_box::split_paragraphs(
+      char const* first, char const* last
+    , master_glyphs const& source
+    , std::size_t chunk_size
+    , paragraphs& out
+    , std::atomic<bool> const* cancelled
+   )
+   {
+      // Paragraphs are delimited by newlines. The newline belongs to the
+      // paragraph it starts (see paragraph). This is also called from the
+      // layout worker thread (see start_layout), so it may not touch the
+      // text box. Returns false if cancelled.
+      auto start = first;
+      auto i = (first == last)? last : first + 1;
+      while (true)
+      {
+         i = std::find(i, last, '\n');
+         out.push_back({ master_glyphs{ start, i, source, chunk_size, cancelled } });
+         if (cancelled && *cancelled)
+            return false;
+         if (i == last)
             break;
+         start = i++;
       }
+      return true;
    }
 
-   void static_text_box::sync() const
+   std::size_t static_text_box::estimate_rows(paragraph const& para) const
    {
-      auto f = _text.data();
-      auto l = _text.data() + _text.size();
-      if (f != _layout.begin() || l != _layout.end())
-         _layout.text(f, l);
+      // The width of a paragraph is cheap to get. Divide it by our width,
+      // ignoring where the words actually break.
+      auto width = _current_size.x;
+      if (width <= 0)
+         return 1;
+      auto n = std::ceil(para.layout.width() / width);
+      return std::max<std::size_t>(n, 1);
    }
 
-   void static_text_box::set_text(string_view text)
+   void static_text_box::reset_rows()
    {
-      _text = std::string(text);
       _rows.clear();
-      _layout.text(_text.data(), _text.data() + _text.size());
-      _layout.break_lines(_current_size.x, _rows);
+      _num_broken = 0;
+      _pending_rows = 0;
+      for (auto& para : _paragraphs)
+      {
+         para.num_rows = estimate_rows(para);
+         _pending_rows += para.num_rows;
+      }
+   }
+
+   void static_text_box::truncate_rows(std::size_t para_index)
+   {
+      if (para_index >= _num_broken)
+         return;
+
+      // The paragraphs keep the number of rows they had. Those are not
+      // estimates: they stay right as long as our width does not change.
+      _rows.erase(_rows.begin() + _paragraphs[para_index].first_row, _rows.end());
+      for (auto i = para_index; i != _num_broken; ++i)
+         _pending_rows += _paragraphs[i].num_rows;
+      _num_broken = para_index;
+   }
+
+   void static_text_box::break_next()
+   {
+      // All the rows go into one vector, in order, so line breaking sees
+      // the same preceding rows as it would for the whole text.
+      settle(_num_broken + 1);
+      auto& para = _paragraphs[_num_broken++];
+      _pending_rows -= para.num_rows;
+      para.first_row = _rows.size();
+      para.layout.break_lines(_current_size.x, _rows);
+      para.num_rows = _rows.size() - para.first_row;
+   }
+
+   void static_text_box::break_rows(context const& ctx, std::size_t num_rows_)
+   {
+      if (_current_size.x == -1)
+         return;
+
+      while (_rows.size() < num_rows_ && _num_broken != _paragraphs.size())
+         break_next();
+
+      if (num_rows() * line_height() != _current_size.y)
+         size_changed(ctx);
+   }
+
+   void static_text_box::break_rows(context const& ctx, char const* s)
+   {
+      if (_current_size.x == -1)
+         return;
+
+      while (_num_broken != _paragraphs.size()
+         && paragraph_begin(_num_broken) <= s)
+         break_next();
+
+      if (num_rows() * line_height() != _current_size.y)
+         size_changed(ctx);
+   }
+
+   void static_text_box::size_changed(context const& ctx)
+   {
+      // Our height changed, or our estimate of it was off. Take the new
+      // height and relayout so that our containers follow (only them, not
+      // the whole view).
+      _current_size.y = num_rows() * line_height();
+      ctx.view.post(
+         [wp = _self.get(this), &view = ctx.view]
+         {
+            if (auto p = wp.lock())
+               view.layout(**p);
+         }
+      );
+   }
+
+   void static_text_box::replace_text(std::size_t pos, std::size_t len, string_view str)
+   {
+      finish_layout();
+      sync();
+
+      auto const old_first = _text->data();
+      pos = std::min(pos, _text->size());
+      len = std::min(len, _text->size() - pos);
+
+      // Find the paragraphs [a, b] touched by the edit. An edit at the start
+      // of a paragraph (its newline) also touches the paragraph before it.
+      auto find = [&](std::size_t offset) -> std::size_t
+      {
+         // upper_bound, less one
+         auto p = old_first + offset;
+         std::size_t lo = 0, hi = _paragraphs.size();
+         while (lo != hi)
+         {
+            auto mid = lo + (hi - lo) / 2;
+            if (p < paragraph_begin(mid))
+               hi = mid;
+            else
+               lo = mid + 1;
+         }
+         return lo? lo-1 : 0;
+      };
+
+      auto a = find(pos? pos-1 : 0);
+      auto b = find(pos + len);
+      settle(b + 1);
+      auto region_first = std::size_t(_paragraphs[a].layout.begin() - old_first);
+      auto region_last = std::size_t(_paragraphs[b].layout.end() - old_first);
+
+      // The rows from paragraph a on will have to be broken again
+      auto was_broken = a < _num_broken;
+      truncate_rows(a);
+
+      _text->replace(pos, len, str);
+
+      auto const first = _text->data();
+      region_last = region_last + str.size() - len;
+
+      // Rebase the paragraphs (and the rows) we keep. Only the paragraphs
+      // before a have rows.
+      if (old_first != first)
+      {
+         for (auto i = std::size_t(0); i != a; ++i)
+            _paragraphs[i].layout.rebase(old_first, first);
+         for (auto& row : _rows)
+            row.rebase(old_first, first);
+      }
+
+      // The paragraphs after b are shifted lazily. If some of them were
+      // already settled, catch those up with the rest first.
+      if (_shift_from == no_shift)
+      {
+         _shift_from = b+1;
+         _shift_base = old_first;
+         _shift = 0;
+      }
+      else
+      {
+         for (auto i = b+1; i != _shift_from; ++i)
+            _paragraphs[i].layout.rebase(old_first + len, first + str.size());
+      }
+      _shift += std::ptrdiff_t(str.size()) - std::ptrdiff_t(len);
+
+      // Re-segment and re-shape the edited region
+      for (auto i = a; i != b+1; ++i)
+         _pending_rows -= _paragraphs[i].num_rows;
+
+      paragraphs edited;
+      split_paragraphs(first + region_first, first + region_last, _layout, _text->chunk_size(), edited);
+      for (auto& para : edited)
+      {
+         para.num_rows = estimate_rows(para);
+         _pending_rows += para.num_rows;
+      }
+
+      // Replace the paragraphs in place, so that the ones after them move
+      // only if the number of paragraphs changes
+      auto num_old = b - a + 1;
+      auto num_new = edited.size();
+      auto common = std::min(num_old, num_new);
+      std::move(edited.begin(), edited.begin() + common, _paragraphs.begin() + a);
+      if (num_new > num_old)
+      {
+         _paragraphs.insert(
+            _paragraphs.begin() + a + common
+          , std::make_move_iterator(edited.begin() + common)
+          , std::make_move_iterator(edited.end())
+         );
+      }
+      else
+      {
+         _paragraphs.erase(_paragraphs.begin() + a + common, _paragraphs.begin() + b + 1);
+      }
+
+      _shift_from = _shift_from + num_new - num_old;
+      if (_shift_from >= _paragraphs.size())
+         _shift_from = no_shift;
+
+      // Break the edited paragraphs right away if we had broken them (they
+      // are likely in view). Our height is then exact: it changes only if
+      // the number of rows does.
+      if (was_broken)
+      {
+         while (_num_broken != a + num_new)
+            break_next();
+      }
+   }
+
+   void static_text_box::set_text(string_view text)
+   {
+      cancel_layout();
+      if (_async_threshold && text.size() >= _async_threshold)
+      {
+         // Shaped in the background, once we know our view (see start_layout)
+         _layout_job = std::make_shared<layout_job>(std::string(text), _layout, _text->chunk_size());
+      }
+      else
+      {
+         _text->assign(std::string(text));
+         _paragraphs.clear();
+         sync();
+      }
+      invalidate_limits(*this);
+   }
+
+   std::string const& static_text_box::get_text() const
+   {
+      // While a layout is pending, its text is the one we were given
+      return _layout_job? _layout_job->text : _text->str();
+   }
+
+   void static_text_box::start_layout(context const& ctx)
+   {
+      // A large text given to the constructor is shaped in the background
+      // too. We show nothing until it is done.
+      if (!_layout_job && _paragraphs.empty()
+         && _async_threshold && _text->size() >= _async_threshold)
+      {
+         _layout_job = std::make_shared<layout_job>(_text->str(), _layout, _text->chunk_size());
+         _text->assign({});
+      }
+
+      if (!_layout_job)
+         return;
+
+      // The job is done but we did not get its result (e.g. we were moved
+      // while it was shaped). Take it now.
+      if (_layout_job->done)
+      {
+         adopt_layout();
+         return;
+      }
+
+      if (_layout_job->posted)
+         return;
+      _layout_job->posted = true;
+
+      // The result is posted to the view. By then, we may have been
+      // destroyed, moved or given another text: the handle tells which.
+      // Our containers are the only ones that need a relayout.
+      get_layout_worker().post(
+         [job = _layout_job, wp = _self.get(this), &view_ = ctx.view]
+         {
+            {
+               std::lock_guard<std::mutex> lock(job->mutex);
+               if (job->cancelled || job->started)
+                  return;
+               job->started = true;
+            }
+
+            try
+            {
+               auto first = job->text.data();
+               auto last = first + job->text.size();
+               split_paragraphs(
+                  first, last, job->source, job->chunk_size, job->result, &job->cancelled);
+            }
+            catch (...)
+            {
+               job->error = std::current_exception();
+            }
+
+            // A text box cancels its job before it lets go of it (e.g. if
+            // it is destroyed with its view). Post nothing if it did.
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->done = true;
+            job->finished.notify_all();
+            if (job->cancelled)
+               return;
+
+            view_.post(
+               [job, wp, &view_]
+               {
+                  auto p = wp.lock();
+                  if (p && (*p)->_layout_job == job)
+                  {
+                     auto& self = **p;
+                     self.adopt_layout();
+                     view_.layout(self);
+                  }
+                  else if (!job->cancelled && !job->adopted)
+                  {
+                     // Moved: the text box takes the result when it is
+                     // drawn (see above)
+                     view_.refresh();
+                  }
+               }
+            );
+         }
+      );
+   }
+
+   void static_text_box::cancel_layout()
+   {
+      // The worker stops shaping as soon as it sees it. We do not wait.
+      if (!_layout_job)
+         return;
+      {
+         std::lock_guard<std::mutex> lock(_layout_job->mutex);
+         _layout_job->cancelled = true;
+      }
+      _layout_job.reset();
+   }
+
+   void static_text_box::finish_layout()
+   {
+      // Wait for the pending layout, or do it here if the worker did not
+      // start it yet
+      if (!_layout_job)
+         return;
+
+      auto& job = *_layout_job;
+      {
+         std::unique_lock<std::mutex> lock(job.mutex);
+         if (job.started)
+         {
+            job.finished.wait(lock, [&]{ return bool(job.done); });
+         }
+         else
+         {
+            job.started = true;
+            lock.unlock();
+            auto first = job.text.data();
+            split_paragraphs(first, first + job.text.size(), job.source, job.chunk_size, job.result);
+         }
+      }
+      adopt_layout();
+   }
+
+   void static_text_box::adopt_layout()
+   {
+      auto job = std::move(_layout_job);
+      job->adopted = true;
+      if (job->error)
+         std::rethrow_exception(job->error);
+
+      // Moving the text keeps its buffer, which the paragraphs point to,
+      // unless the text is short enough to be stored in place. In that
+      // case, sync shapes it again.
+      _text->assign(std::move(job->text));
+      _paragraphs = std::move(job->result);
+      _shift_from = no_shift;
+      sync();
+      reset_rows();
+      invalidate_limits(*this);
    }
 
    void static_text_box::value(string_view val)
@@ -122,6 +680,18 @@ namespace cycfi { namespace elements
     , _select_start(-1)
     , _select_end(-1)
     , _current_x(0)
+    , _typing(false)
+    , _is_focus(false)
+    , _show_caret(true)
+    , _caret_started(false)
+   {}
+
+   basic_text_box::basic_text_box(text_storage_ptr text, font font_, float size)
+    : static_text_box(std::move(text), font_, size)
+    , _select_start(-1)
+    , _select_end(-1)
+    , _current_x(0)
+    , _typing(false)
     , _is_focus(false)
     , _show_caret(true)
     , _caret_started(false)
@@ -134,6 +704,14 @@ namespace cycfi { namespace elements
 
    void basic_text_box::draw(context const& ctx)
    {
+      // The selection does not apply to the text we are showing until the
+      // pending layout is done. We do not take edits until then either.
+      if (layout_pending())
+      {
+         static_text_box::draw(ctx);
+         return;
+      }
+
       draw_selection(ctx);
       static_text_box::draw(ctx);
       draw_caret(ctx);
@@ -141,7 +719,7 @@ namespace cycfi { namespace elements
 
    bool basic_text_box::click(context const& ctx, mouse_button btn)
    {
-      if (btn.state != mouse_button::left)
+      if (btn.state != mouse_button::left || layout_pending())
          return false;
 
       _show_caret = true;
@@ -149,15 +727,15 @@ namespace cycfi { namespace elements
       if (!btn.down) // released? return early
          return true;
 
-      if (_text.empty())
+      if (_text->empty())
       {
          _select_start = _select_end = 0;
          scroll_into_view(ctx, false);
          return true;
       }
 
-      char const*   _first = _text.data();
-      char const*   _last = _first + _text.size();
+      char const*   _first = _text->data();
+      char const*   _last = _first + _text->size();
 
       if (char const* pos = caret_position(ctx, btn.pos))
       {
@@ -214,7 +792,10 @@ namespace cycfi { namespace elements
 
    void basic_text_box::drag(context const& ctx, mouse_button btn)
    {
-      char const* first = &_text[0];
+      if (layout_pending())
+         return;
+
+      char const* first = _text->data();
       if (char const* pos = caret_position(ctx, btn.pos))
       {
          _select_end = int(pos-first);
@@ -233,23 +814,50 @@ namespace cycfi { namespace elements
       return false;
    }
 
-   namespace
+   struct basic_text_box::edit_record
    {
-      void add_undo(
-         context const& ctx
-       , std::function<void()>& typing_state
-       , std::function<void()> undo_f
-       , std::function<void()> redo_f
-      )
+      struct change
       {
-         if (typing_state)
-         {
-            ctx.view.add_undo({ typing_state, undo_f });
-            typing_state = {}; // reset
-         }
-         ctx.view.add_undo({ undo_f, redo_f });
+         std::size_t    pos;
+         std::string    removed;
+         std::string    inserted;
+      };
+
+      void undo(basic_text_box& self) const
+      {
+         if (generation != self._generation)
+            return;
+         for (auto i = changes.rbegin(); i != changes.rend(); ++i)
+            self.static_text_box::replace_text(i->pos, i->inserted.size(), i->removed);
+         self._select_start = select_start;
+         self._select_end = select_end;
+      }
+
+      void redo(basic_text_box& self) const
+      {
+         if (generation != self._generation)
+            return;
+         for (auto const& c : changes)
+            self.static_text_box::replace_text(c.pos, c.removed.size(), c.inserted);
+         self._select_start = after_start;
+         self._select_end = after_end;
       }
-   }
+
+      std::size_t size() const
+      {
+         std::size_t n = sizeof(*this);
+         for (auto const& c : changes)
+            n += sizeof(c) + c.removed.capacity() + c.inserted.capacity();
+         return n;
+      }
+
+      std::vector<change>  changes;
+      std::size_t          generation;       // of the text it applies to
+      int                  select_start;
+      int                  select_end;
+      int                  after_start = 0;
+      int                  after_end = 0;
+   };
 
    void break_()
    {
@@ -259,7 +867,7 @@ namespace cycfi { namespace elements
    {
       _show_caret = true;
 
-      if (_select_start == -1)
+      if (_select_start == -1 || layout_pending())
          return false;
 
       if (_select_start > _select_end)
@@ -267,21 +875,14 @@ namespace cycfi { namespace elements
 
       std::string text = codepoint_to_utf8(info_.codepoint);
 
-      if (!_typing_state)
-         _typing_state = capture_state();
-
-      bool replace = false;
-      if (_select_start == _select_end)
-      {
-         _text.insert(_select_start, text);
-      }
-      else
+      if (!_typing)
       {
-         _text.replace(_select_start, _select_end-_select_start, text);
-         replace = true;
+         begin_edit(ctx);
+         _typing = true;
       }
 
-      _layout.text(_text.data(), _text.data() + _text.size());
+      bool replace = _select_start != _select_end;
+      replace_text(_select_start, _select_end-_select_start, text);
       layout(ctx);
 
       if (replace)
@@ -295,11 +896,20 @@ namespace cycfi { namespace elements
          _select_end = _select_start += text.length();
          scroll_into_view(ctx, true);
       }
+
+      _edit->after_start = _select_start;
+      _edit->after_end = _select_end;
       return true;
    }
 
    void basic_text_box::set_text(string_view text_)
    {
+      // The edit we are recording, and those in the view's undo and redo
+      // stacks, no longer apply: their offsets are into the old text.
+      _edit.reset();
+      _typing = false;
+      ++_generation;
+
       static_text_box::set_text(text_);
       _select_start = std::min<int>(_select_start, text_.size());
       _select_end = std::min<int>(_select_end, text_.size());
@@ -310,6 +920,7 @@ namespace cycfi { namespace elements
       _show_caret = true;
 
       if (_select_start == -1
+         || layout_pending()
          || k.action == key_action::release
          || k.action == key_action::unknown
          )
@@ -321,33 +932,32 @@ namespace cycfi { namespace elements
 
       int start = std::min(_select_end, _select_start);
       int end = std::max(_select_end, _select_start);
-      std::function<void()> undo_f = capture_state();
 
       auto up_down = [this, &ctx, k, &move_caret]()
       {
          bool up = k.key == key_code::up;
          glyph_metrics info;
-         info = glyph_info(ctx, &_text[_select_end]);
+         info = glyph_info(ctx, _text->data() + _select_end);
          if (info.str)
          {
             auto y = up ? -info.line_height : +info.line_height;
             auto pos = point{ ctx.bounds.left + _current_x, info.pos.y + y };
             char const* cp = caret_position(ctx, pos);
             if (cp)
-               _select_end = int(cp - &_text[0]);
+               _select_end = int(cp - _text->data());
             else
-               _select_end = up ? 0 : int(_text.size());
+               _select_end = up ? 0 : int(_text->size());
             move_caret = true;
          }
       };
 
       auto next_char = [this]()
       {
-         if (_select_end < static_cast<int>(_text.size()))
+         if (_select_end < static_cast<int>(_text->size()))
          {
-            char const* end = _text.data() + _text.size();
-            char const* p = next_utf8(end, &_text[_select_end]);
-            _select_end = int(p - &_text[0]);
+            char const* end = _text->data() + _text->size();
+            char const* p = next_utf8(end, _text->data() + _select_end);
+            _select_end = int(p - _text->data());
          }
       };
 
@@ -355,23 +965,23 @@ namespace cycfi { namespace elements
       {
          if (_select_end > 0)
          {
-            char const* start = &_text[0];
-            char const* p = prev_utf8(start, &_text[_select_end]);
-            _select_end = int(p - &_text[0]);
+            char const* start = _text->data();
+            char const* p = prev_utf8(start, _text->data() + _select_end);
+            _select_end = int(p - _text->data());
          }
       };
 
       auto next_word = [this]()
       {
-         if (_select_end < static_cast<int>(_text.size()))
+         if (_select_end < static_cast<int>(_text->size()))
          {
-            char const* p = &_text[_select_end];
-            char const* end = _text.data() + _text.size();
+            char const* p = _text->data() + _select_end;
+            char const* end = _text->data() + _text->size();
             while (p != end && word_break(p))
                p = next_utf8(end, p);
             while (p != end && !word_break(p))
                p = next_utf8(end, p);
-            _select_end = int(p - &_text[0]);
+            _select_end = int(p - _text->data());
          }
       };
 
@@ -379,18 +989,18 @@ namespace cycfi { namespace elements
       {
          if (_select_end > 0)
          {
-            char const* start = &_text[0];
-            char const* p = prev_utf8(start, &_text[_select_end]);
+            char const* start = _text->data();
+            char const* p = prev_utf8(start, _text->data() + _select_end);
             while (p != start && word_break(p))
                p = prev_utf8(start, p);
             while (p != start && !word_break(p))
                p = prev_utf8(start, p);
             if (p != start)
             {
-               char const* end = _text.data() + _text.size();
+               char const* end = _text->data() + _text->size();
                p = next_utf8(end, p);
             }
-            _select_end = int(p - &_text[0]);
+            _select_end = int(p - _text->data());
          }
       };
 
@@ -400,11 +1010,12 @@ namespace cycfi { namespace elements
          {
             case key_code::enter:
                {
-                  _text.replace(start, end-start, "\n");
-                  _select_start += 1;
+                  begin_edit(ctx);
+                  replace_text(start, end-start, "\n");
+                  _select_start = start + 1;
                   _select_end = _select_start;
+                  end_edit(ctx);
                   save_x = true;
-                  add_undo(ctx, _typing_state, undo_f, capture_state());
                   handled = true;
                }
                break;
@@ -412,9 +1023,10 @@ namespace cycfi { namespace elements
             case key_code::backspace:
             case key_code::_delete:
                {
+                  begin_edit(ctx);
                   delete_(k.key == key_code::_delete);
+                  end_edit(ctx);
                   save_x = true;
-                  add_undo(ctx, _typing_state, undo_f, capture_state());
                   handled = true;
                }
                break;
@@ -460,7 +1072,7 @@ namespace cycfi { namespace elements
                if (k.modifiers & mod_action)
                {
                   _select_start = 0;
-                  _select_end = int(_text.size());
+                  _select_end = int(_text->size());
                   handled = true;
                }
                break;
@@ -468,9 +1080,10 @@ namespace cycfi { namespace elements
             case key_code::x:
                if (k.modifiers & mod_action)
                {
+                  begin_edit(ctx);
                   cut(ctx.view, start, end);
+                  end_edit(ctx);
                   save_x = true;
-                  add_undo(ctx, _typing_state, undo_f, capture_state());
                   handled = true;
                }
                break;
@@ -486,9 +1099,10 @@ namespace cycfi { namespace elements
             case key_code::v:
                if (k.modifiers & mod_action)
                {
+                  begin_edit(ctx);
                   paste(ctx.view, start, end);
+                  end_edit(ctx);
                   save_x = true;
-                  add_undo(ctx, _typing_state, undo_f, capture_state());
                   handled = true;
                }
                break;
@@ -496,12 +1110,7 @@ namespace cycfi { namespace elements
             case key_code::z:
                if (k.modifiers & mod_action)
                {
-                  if (_typing_state)
-                  {
-                     ctx.view.add_undo({ _typing_state, undo_f });
-                     _typing_state = {}; // reset
-                  }
-
+                  end_edit(ctx);   // commit the typing
                   if (k.modifiers & mod_shift)
                      ctx.view.redo();
                   else
@@ -517,14 +1126,13 @@ namespace cycfi { namespace elements
 
       if (move_caret)
       {
-         clamp(_select_start, 0, int(_text.size()));
-         clamp(_select_end, 0, int(_text.size()));
+         clamp(_select_start, 0, int(_text->size()));
+         clamp(_select_end, 0, int(_text->size()));
          if (!(k.modifiers & mod_shift))
             _select_start = _select_end;
       }
       else if (handled)
       {
-         _layout.text(_text.data(), _text.data() + _text.size());
          layout(ctx);
          ctx.view.refresh(ctx);
       }
@@ -557,7 +1165,7 @@ namespace cycfi { namespace elements
       bool has_caret = false;
 
       // Handle the case where text is empty
-      if (_text.empty())
+      if (_text->empty())
       {
          auto  size = _layout.metrics();
          auto  line_height = size.ascent + size.descent + size.leading;
@@ -580,7 +1188,7 @@ namespace cycfi { namespace elements
       // Draw the caret
       else if (_select_start == _select_end)
       {
-         auto  start_info = glyph_info(ctx, _text.data() + _select_start);
+         auto  start_info = glyph_info(ctx, _text->data() + _select_start);
          auto width = theme.text_box_caret_width;
          rect& caret = start_info.bounds;
 
@@ -627,13 +1235,13 @@ namespace cycfi { namespace elements
       auto& canvas = ctx.canvas;
       auto const& theme = get_theme();
 
-      if (!_text.empty())
+      if (!_text->empty())
       {
-         auto  start_info = glyph_info(ctx, _text.data() + _select_start);
+         auto  start_info = glyph_info(ctx, _text->data() + _select_start);
          rect& r1 = start_info.bounds;
          r1.right = ctx.bounds.right;
 
-         auto  end_info = glyph_info(ctx, _text.data() + _select_end);
+         auto  end_info = glyph_info(ctx, _text->data() + _select_end);
          rect& r2 = end_info.bounds;
          r2.right = r2.left;
          r2.left = ctx.bounds.left;
@@ -670,39 +1278,37 @@ namespace cycfi { namespace elements
       auto  metrics = _layout.metrics();
       auto  line_height = metrics.ascent + metrics.descent + metrics.leading;
 
+      if (p.y < y)
+         return nullptr;
+
+      // All rows have the same height. Make sure the row at p has been
+      // broken.
+      auto i = std::size_t((p.y - y) / line_height);
+      break_rows(ctx, i + 1);
+      if (i >= _rows.size())
+         return nullptr;
+
+      // Check if we are at the very start of the row or beyond
+      auto& row = _rows[i];
+      if (p.x <= x)
+         return row.begin();
+
+      // Get the actual coordinates of the glyph
       char const* found = nullptr;
-      for (auto& row : _rows)
-      {
-         // Check if p is within this row
-         if ((p.y >= y) && (p.y < y + line_height))
+      row.for_each(
+         [p, x, &found](char const* utf8, float left, float right)
          {
-            // Check if we are at the very start of the row or beyond
-            if (p.x <= x)
+            if ((p.x >= (x + left)) && (p.x < (x + right)))
             {
-               found = row.begin();
-               break;
+               found = utf8;
+               return false;
             }
-
-            // Get the actual coordinates of the glyph
-            row.for_each(
-               [p, x, &found](char const* utf8, float left, float right)
-               {
-                  if ((p.x >= (x + left)) && (p.x < (x + right)))
-                  {
-                     found = utf8;
-                     return false;
-                  }
-                  return true;
-               }
-            );
-            // Assume it's at the end of the row if we haven't found a hit
-            if (!found)
-               found = row.end();
-            break;
+            return true;
          }
-         y += line_height;
-      }
-      return found;
+      );
+
+      // Assume it's at the end of the row if we haven't found a hit
+      return found? found : row.end();
    }
 
    basic_text_box::glyph_metrics basic_text_box::glyph_info(context const& ctx, char const* s)
@@ -719,8 +1325,11 @@ namespace cycfi { namespace elements
       info.str = nullptr;
       info.line_height = line_height;
 
+      // Make sure the rows up to s have been broken
+      break_rows(ctx, s);
+
       // Check if s is at the very end
-      if (s == _text.data() + _text.size())
+      if (s == _text->data() + _text->size())
       {
          auto const& last_row = _rows.back();
          auto        rightmost = x + last_row.width();
@@ -732,43 +1341,45 @@ namespace cycfi { namespace elements
          return info;
       }
 
-      glyphs*  prev_row = nullptr;
-      for (auto& row : _rows)
+      // Find the first row that ends after s. The rows are in text order.
+      auto i = std::upper_bound(_rows.begin(), _rows.end(), s,
+         [](char const* s, glyphs const& row) { return s < row.end(); }
+      );
+      if (i == _rows.end())
+         return info;
+
+      auto& row = *i;
+      y += line_height * (i - _rows.begin());
+
+      // Check if s is within this row
+      if (s >= row.begin())
       {
-         // Check if s is within this row
-         if (s >= row.begin() && s < row.end())
-         {
-            // Get the actual coordinates of the glyph
-            row.for_each(
-               [s, &info, x, y, ascent, descent](char const* utf8, float left, float right)
+         // Get the actual coordinates of the glyph
+         row.for_each(
+            [s, &info, x, y, ascent, descent](char const* utf8, float left, float right)
+            {
+               if (utf8 >= s)
                {
-                  if (utf8 >= s)
-                  {
-                     info.pos = { x + left, y };
-                     info.bounds = { x + left, y - ascent, x + right, y + descent };
-                     info.str = utf8;
-                     return false;
-                  }
-                  return true;
+                  info.pos = { x + left, y };
+                  info.bounds = { x + left, y - ascent, x + right, y + descent };
+                  info.str = utf8;
+                  return false;
                }
-            );
-            break;
-         }
-         // This handles the case where s is in between the start of the
-         // current row and the end of the previous.
-         else if (s < row.begin() && prev_row)
-         {
-            auto  rightmost = x + prev_row->width();
-            auto  prev_y = y - line_height;
-            info.pos = { rightmost, prev_y };
-            info.bounds = { rightmost, prev_y - ascent, rightmost + 10, prev_y + descent };
-            info.str = s;
-            break;
-         }
-         y += line_height;
-         prev_row = &row;
+               return true;
+            }
+         );
+         return info;
       }
 
+      // This handles the case where s is in between the start of the
+      // row and the end of the previous.
+      if (i == _rows.begin())
+         return info;
+      auto  rightmost = x + (i - 1)->width();
+      auto  prev_y = y - line_height;
+      info.pos = { rightmost, prev_y };
+      info.bounds = { rightmost, prev_y - ascent, rightmost + 10, prev_y + descent };
+      info.str = s;
       return info;
    }
 
@@ -782,24 +1393,24 @@ namespace cycfi { namespace elements
          {
             if (forward)
             {
-               char const* start_p = &_text[start];
-               char const* end_p = &_text[0] + _text.size();
+               char const* start_p = _text->data() + start;
+               char const* end_p = _text->data() + _text->size();
                char const* p = next_utf8(end_p, start_p);
-               start = int(start_p - &_text[0]);
-               _text.erase(start, p - start_p);
+               start = int(start_p - _text->data());
+               replace_text(start, p - start_p, "");
             }
             else if (start > 0)
             {
-               char const* start_p = &_text[0];
-               char const* end_p = &_text[start];
+               char const* start_p = _text->data();
+               char const* end_p = _text->data() + start;
                char const* p = prev_utf8(start_p, end_p);
-               start = int(p - &_text[0]);
-               _text.erase(start, end_p - p);
+               start = int(p - _text->data());
+               replace_text(start, end_p - p, "");
             }
          }
          else
          {
-            _text.erase(start, end-start);
+            replace_text(start, end-start, "");
          }
          _select_end = _select_start = start;
       }
@@ -811,7 +1422,7 @@ namespace cycfi { namespace elements
       {
          auto  end_ = std::max(start, end);
          auto  start_ = std::min(start, end);
-         clipboard(_text.substr(start, end_-start_));
+         clipboard(_text->substr(start, end_-start_));
          delete_(false);
       }
    }
@@ -822,7 +1433,7 @@ namespace cycfi { namespace elements
       {
          auto  end_ = std::max(start, end);
          auto  start_ = std::min(start, end);
-         clipboard(_text.substr(start, end_-start_));
+         clipboard(_text->substr(start, end_-start_));
       }
    }
 
@@ -833,48 +1444,69 @@ namespace cycfi { namespace elements
          auto  end_ = std::max(start, end);
          auto  start_ = std::min(start, end);
          std::string ins = clipboard();
-         _text.replace(start, end_-start_, ins);
+         replace_text(start, end_-start_, ins);
          start += ins.size();
          _select_end = _select_start = start;
       }
    }
 
-   struct basic_text_box::state_saver
+   void basic_text_box::replace_text(std::size_t pos, std::size_t len, string_view str)
    {
-      state_saver(basic_text_box* this_)
-       : text(this_->_text)
-       , select_start(this_->_select_start)
-       , select_end(this_->_select_end)
-       , save_text(this_->_text)
-       , save_select_start(this_->_select_start)
-       , save_select_end(this_->_select_end)
-      {}
-
-      void operator()()
+      if (_edit)
       {
-         text = save_text;
-         select_start = save_select_start;
-         select_end = save_select_end;
+         pos = std::min(pos, _text->size());
+         len = std::min(len, _text->size() - pos);
+
+         // Coalesce insertions that continue the last change (e.g. typing)
+         auto& changes = _edit->changes;
+         if (len == 0 && !changes.empty()
+            && changes.back().pos + changes.back().inserted.size() == pos)
+            changes.back().inserted.append(str.begin(), str.end());
+         else
+            changes.push_back({ pos, _text->substr(pos, len), std::string(str) });
       }
+      static_text_box::replace_text(pos, len, str);
+   }
 
-      std::string&   text;
-      int&           select_start;
-      int&           select_end;
-
-      std::string    save_text;
-      int            save_select_start;
-      int            save_select_end;
-   };
+   void basic_text_box::begin_edit(context const& ctx)
+   {
+      end_edit(ctx);
+      _edit = std::make_shared<edit_record>();
+      _edit->generation = _generation;
+      _edit->select_start = _select_start;
+      _edit->select_end = _select_end;
+   }
 
-   std::function<void()>
-   basic_text_box::capture_state()
+   void basic_text_box::end_edit(context const& ctx)
    {
-      return state_saver(this);
+      if (!_edit)
+         return;
+
+      auto record = std::move(_edit);
+      _edit.reset();
+
+      // For typing, text() keeps the selection after the last entry
+      if (!_typing)
+      {
+         record->after_start = _select_start;
+         record->after_end = _select_end;
+      }
+      _typing = false;
+
+      if (record->changes.empty())
+         return;
+
+      auto& self = *this;
+      ctx.view.add_undo({
+         [&self, record]() { record->undo(self); }
+       , [&self, record]() { record->redo(self); }
+       , record->size()
+      });
    }
 
    void basic_text_box::scroll_into_view(context const& ctx, bool save_x)
    {
-      if (_text.empty())
+      if (_text->empty())
       {
          auto caret = rect{
             ctx.bounds.left-1,
@@ -892,7 +1524,7 @@ namespace cycfi { namespace elements
       if (_select_end == -1)
          return;
 
-      auto info = glyph_info(ctx, &_text[_select_end]);
+      auto info = glyph_info(ctx, _text->data() + _select_end);
       if (info.str)
       {
          auto caret = rect{
@@ -928,20 +1560,20 @@ namespace cycfi { namespace elements
 
    void basic_text_box::select_start(int pos)
    {
-      if (pos == -1 || (pos >= 0 && pos <= static_cast<int>(_text.size())))
+      if (pos == -1 || (pos >= 0 && pos <= static_cast<int>(_text->size())))
          _select_start = pos;
    }
 
    void basic_text_box::select_end(int pos)
    {
-      if (pos == -1 || (pos >= 0 && pos <= static_cast<int>(_text.size())))
+      if (pos == -1 || (pos >= 0 && pos <= static_cast<int>(_text->size())))
          _select_end = pos;
    }
 
    void basic_text_box::select_all()
    {
       _select_start = 0;
-      _select_end = int(_text.size());
+      _select_end = int(_text->size());
    }
 
    void basic_text_box::select_none()
@@ -1035,7 +1667,7 @@ namespace cycfi { namespace elements
 
             case key_code::end:
                {
-                  int end = int(_text.size());
+                  int end = int(_text->size());
                   select_start(end);
                   select_end(end);
                   scroll_into_view(ctx, false);
@@ -1075,13 +1707,13 @@ namespace cycfi { namespace elements
             ins += *p;
          }
 
-         _text.replace(start_, end_-start_, ins);
+         replace_text(start_, end_-start_, ins);
          start_ += ins.size();
          select_start(start_);
          select_end(start_);
 
          if (on_text)
-            on_text(_text);
+            on_text(_text->str());
       }
    }
 
@@ -1089,7 +1721,7 @@ namespace cycfi { namespace elements
    {
       basic_text_box::delete_(forward);
       if (on_text)
-         on_text(_text);
+         on_text(_text->str());
    }
 
    bool basic_input_box::click(context const& ctx, mouse_button btn)
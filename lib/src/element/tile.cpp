@@ -6,6 +6,7 @@
 =============================================================================*/
 #include <elements/element/tile.hpp>
 #include <elements/support/context.hpp>
+#include <elements/view.hpp>
 
 #include <algorithm>
 #include <numeric>
@@ -18,7 +19,6 @@ namespace cycfi { namespace elements
       struct layout_info
       {
          float min, max, stretch, alloc;
-         std::size_t index;
       };
 
       bool is_almost_zero(float val, int ulp = 1)
@@ -30,12 +30,12 @@ namespace cycfi { namespace elements
          val <= std::numeric_limits<float>::epsilon() * val * ulp;
       }
 
-      auto range(layout_info info)
+      auto range(layout_info const& info)
       {
          return info.max - info.min;
       }
 
-      auto density(layout_info info)
+      auto density(layout_info const& info)
       {
          auto r = range(info);
 
@@ -48,10 +48,14 @@ namespace cycfi { namespace elements
       // Distribute space proportionally to each element stretchiness.
       // Each element will get at least stretch / sum_stretch * free_space,
       // but may get more if other elements reach their max size.
-      void allocate(float space, std::vector<layout_info>& elements)
+      void allocate(
+         float space, layout_info* elements, std::size_t size
+       , detail::scratch_arena& arena
+      )
       {
-         auto const sum_min = std::accumulate(elements.begin(), elements.end(), 0.0f,
-            [](double sum, layout_info elem){ return sum + elem.min; });
+         auto const last = elements + size;
+         auto const sum_min = std::accumulate(elements, last, 0.0f,
+            [](double sum, layout_info const& elem){ return sum + elem.min; });
 
          if (sum_min >= space)
             return;
@@ -60,18 +64,26 @@ namespace cycfi { namespace elements
          // then they will be first. This simplifies the algorithm from O(n * n)
          // to O(n log n) because any remaining free space can be redistributed
          // according to the new sum of stretch proportions without having to redo
-         // space allocations for previous elements.
-         std::sort(elements.begin(), elements.end(),
-            [](layout_info lhs, layout_info rhs){ return density(lhs) > density(rhs); });
-         auto sum_stretch = std::accumulate(elements.begin(), elements.end(), 0.0f,
-            [](double sum, layout_info elem){ return sum + elem.stretch; });
+         // space allocations for previous elements. We sort the indices of the
+         // elements, leaving the elements in their order.
+         auto densities = arena.allocate<float>(size);
+         auto order = arena.allocate<std::size_t>(size);
+         for (std::size_t i = 0; i != size; ++i)
+            densities[i] = density(elements[i]);
+         std::iota(order, order + size, 0);
+         std::sort(order, order + size,
+            [densities](std::size_t lhs, std::size_t rhs){ return densities[lhs] > densities[rhs]; });
+
+         auto sum_stretch = std::accumulate(elements, last, 0.0f,
+            [](double sum, layout_info const& elem){ return sum + elem.stretch; });
          auto free_space = space - sum_min;
 
-         for (auto& e : elements)
+         for (auto i = order; i != order + size; ++i)
          {
             if (sum_stretch <= 0.0f || is_almost_zero(sum_stretch))
                break;
 
+            auto& e = elements[*i];
             auto const alloc = e.stretch / sum_stretch * free_space;
             auto const r = range(e);
             if (alloc >= r)
@@ -85,10 +97,38 @@ namespace cycfi { namespace elements
                e.alloc += alloc;
             }
          }
+      }
 
-         // retain initial order needed for further calculations
-         std::sort(elements.begin(), elements.end(),
-            [](layout_info lhs, layout_info rhs){ return lhs.index < rhs.index; });
+      // Returns true if the space and the elements are the same as in the
+      // previous allocation. Otherwise, records them for the next time.
+      bool same_allocation(
+         float space, layout_info const* elements, std::size_t size
+       , float& prev_space, std::vector<detail::tile_limits>& prev
+      )
+      {
+         auto same = [](layout_info const& e, detail::tile_limits const& l)
+         {
+            return e.min == l.min && e.max == l.max && e.stretch == l.stretch;
+         };
+
+         if (space == prev_space
+            && std::equal(elements, elements + size, prev.begin(), prev.end(), same))
+            return true;
+
+         prev_space = space;
+         prev.resize(size);
+         for (std::size_t i = 0; i != size; ++i)
+            prev[i] = { elements[i].min, elements[i].max, elements[i].stretch };
+         return false;
+      }
+
+      // The tiles that may overlap [from, to]. Each tile ends where the next
+      // one starts.
+      composite_base::index_range tiles_in(std::vector<float> const& tiles, float from, float to)
+      {
+         auto first = std::lower_bound(tiles.begin(), tiles.end(), from) - tiles.begin();
+         auto last = std::upper_bound(tiles.begin(), tiles.end(), to) - tiles.begin() + 1;
+         return { std::size_t(first), std::min(std::size_t(last), tiles.size()) };
       }
    }
 
@@ -115,11 +155,18 @@ namespace cycfi { namespace elements
 
    void vtile_element::layout(context const& ctx)
    {
+      // Nothing to do if nothing changed since our last layout. Elements
+      // added or removed (e.g. the rows of a flow) always need one.
+      if (_layout.is_current(ctx, *this) && _tiles.size() == size())
+         return;
+      _layout.update(ctx);
+
       auto const sz = size();
 
       // Collect min, max, and stretch information from each element.
       // Initially set the allocation sizes of each element to its minimum.
-      std::vector<layout_info> info(sz);
+      auto& arena = ctx.view.layout_arena();
+      auto info = arena.allocate<layout_info>(sz);
       for (std::size_t i = 0; i != sz; ++i)
       {
          auto& elem = at(i);
@@ -128,28 +175,33 @@ namespace cycfi { namespace elements
          info[i].min = limits.min.y;
          info[i].max = limits.max.y;
          info[i].alloc = limits.min.y;
-         info[i].index = i;
       }
 
       auto const left = ctx.bounds.left;
       auto const right = ctx.bounds.right;
       auto const top = ctx.bounds.top;
       auto const height = ctx.bounds.height();
-      // Compute the best fit for all elements
-      allocate(height, info);
+
+      // Compute the best fit for all elements, unless we did already for
+      // the same height and elements
+      if (!same_allocation(height, info, sz, _space, _limits) || _tiles.size() != sz)
+      {
+         allocate(height, info, sz, arena);
+         _tiles.resize(sz);
+         auto curr = 0.0f;
+         for (std::size_t i = 0; i != sz; ++i)
+         {
+            curr += info[i].alloc;
+            _tiles[i] = curr;
+         }
+      }
 
       // Now we have the final layout. We can now layout the individual
       // elements.
-      _tiles.resize(sz);
-      auto curr = 0.0f;
       for (std::size_t i = 0; i != sz; ++i)
       {
-         _tiles[i] = curr + info[i].alloc;
-         auto const prev = curr;
-         curr += info[i].alloc;
-
          auto& elem = at(i);
-         rect ebounds = { left, prev+top, right, curr+top };
+         rect ebounds = { left, (i? _tiles[i-1] : 0)+top, right, _tiles[i]+top };
          elem.layout(context{ ctx, &elem, ebounds });
       }
    }
@@ -171,6 +223,14 @@ namespace cycfi { namespace elements
       return rect{ left, (index? _tiles[index-1] : 0)+top, right, _tiles[index]+top };
    }
 
+   vtile_element::index_range vtile_element::elements_in(context const& ctx, rect area) const
+   {
+      if (_tiles.size() != size())
+         return composite_base::elements_in(ctx, area);
+      auto const top = ctx.bounds.top;
+      return tiles_in(_tiles, area.top - top, area.bottom - top);
+   }
+
    ////////////////////////////////////////////////////////////////////////////
    // Horizontal Tiles
    ////////////////////////////////////////////////////////////////////////////
@@ -194,11 +254,18 @@ namespace cycfi { namespace elements
 
    void htile_element::layout(context const& ctx)
    {
+      // Nothing to do if nothing changed since our last layout. Elements
+      // added or removed (e.g. the rows of a flow) always need one.
+      if (_layout.is_current(ctx, *this) && _tiles.size() == size())
+         return;
+      _layout.update(ctx);
+
       auto const sz = size();
 
       // Collect min, max, and stretch information from each element.
       // Initially set the allocation sizes of each element to its minimum.
-      std::vector<layout_info> info(sz);
+      auto& arena = ctx.view.layout_arena();
+      auto info = arena.allocate<layout_info>(sz);
       for (std::size_t i = 0; i != sz; ++i)
       {
          auto& elem = at(i);
@@ -207,28 +274,33 @@ namespace cycfi { namespace elements
          info[i].min = limits.min.x;
          info[i].max = limits.max.x;
          info[i].alloc = limits.min.x;
-         info[i].index = i;
       }
 
       auto const top = ctx.bounds.top;
       auto const bottom = ctx.bounds.bottom;
       auto const left = ctx.bounds.left;
       auto const width = ctx.bounds.width();
-      // Compute the best fit for all elements
-      allocate(width, info);
+
+      // Compute the best fit for all elements, unless we did already for
+      // the same width and elements
+      if (!same_allocation(width, info, sz, _space, _limits) || _tiles.size() != sz)
+      {
+         allocate(width, info, sz, arena);
+         _tiles.resize(sz);
+         auto curr = 0.0f;
+         for (std::size_t i = 0; i != sz; ++i)
+         {
+            curr += info[i].alloc;
+            _tiles[i] = curr;
+         }
+      }
 
       // Now we have the final layout. We can now layout the individual
       // elements.
-      _tiles.resize(sz);
-      auto curr = 0.0f;
       for (std::size_t i = 0; i != sz; ++i)
       {
-         _tiles[i] = curr + info[i].alloc;
-         auto const prev = curr;
-         curr += info[i].alloc;
-
          auto& elem = at(i);
-         rect ebounds = { prev+left, top, curr+left, bottom };
+         rect ebounds = { (i? _tiles[i-1] : 0)+left, top, _tiles[i]+left, bottom };
          elem.layout(context{ ctx, &elem, ebounds });
       }
    }
@@ -249,4 +321,12 @@ namespace cycfi { namespace elements
       auto const left = ctx.bounds.left;
       return rect{ (index? _tiles[index-1] : 0)+left, top, _tiles[index]+left, bottom };
    }
+
+   htile_element::index_range htile_element::elements_in(context const& ctx, rect area) const
+   {
+      if (_tiles.size() != size())
+         return composite_base::elements_in(ctx, area);
+      auto const left = ctx.bounds.left;
+      return tiles_in(_tiles, area.left - left, area.right - left);
+   }
 }}
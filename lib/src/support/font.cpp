@@ -31,14 +31,21 @@
 # include <cairo-quartz.h>
 #endif
 
+#include <cstdint>
+#include <iomanip>
 #include <map>
+#include <unordered_map>
 #include <mutex>
 #include <memory>
 #include <sstream>
+#include <fstream>
 #include <algorithm>
 #include <vector>
 #include <utility>
 #include <type_traits>
+#include <functional>
+#include <system_error>
+#include <cstdlib>
 
 namespace cycfi { namespace elements
 {
@@ -296,28 +303,83 @@ namespace cycfi { namespace elements
 
             return ptr;
          }
+
+         // The font directories and configuration files that determine the
+         // fonts fontconfig would list. This only parses the configuration;
+         // unlike instance(), it does not scan the fonts.
+         std::vector<fs::path> config_paths()
+         {
+            std::vector<fs::path> paths;
+            font_config_ptr conf(FcInitLoadConfig());
+            if (!conf)
+               return paths;
+
+            auto&& add = [&paths](FcStrList* list)
+            {
+               if (!list)
+                  return;
+               while (FcChar8* path = FcStrListNext(list))
+                  paths.push_back(reinterpret_cast<char const*>(path));
+               FcStrListDone(list);
+            };
+
+            add(FcConfigGetConfigDirs(conf.get()));
+            add(FcConfigGetConfigFiles(conf.get()));
+            return paths;
+         }
       } // namespace
 
-      using cairo_font_map_type = std::map<std::string, cairo_font_face_t*>;
+      // Font faces by full name and the faces we've matched to font
+      // descriptors. A font_descr lookup is a single hash probe once we've
+      // seen the descriptor.
+      struct font_descr_entry
+      {
+         bool matches(font_descr const& descr) const
+         {
+            return weight == descr._weight
+               && slant == descr._slant
+               && stretch == descr._stretch
+               && families == descr._families
+               ;
+         }
+
+         std::string          families;
+         std::uint8_t         weight;
+         std::uint8_t         slant;
+         std::uint8_t         stretch;
+         cairo_font_face_t*   face;       // owned by font_cache::faces
+      };
 
-      std::pair<cairo_font_map_type&, std::mutex&> get_cairo_font_map()
+      std::size_t hash_value(font_descr const& descr)
       {
-         static cairo_font_map_type cairo_font_map_;
-         static std::mutex cairo_font_map_mutex_;
+         auto h = std::hash<string_view>{}(descr._families);
+         auto attrs = descr._weight | (descr._slant << 8) | (descr._stretch << 16);
+         return h ^ (std::size_t(attrs) + 0x9e3779b9 + (h << 6) + (h >> 2));
+      }
+
+      struct font_cache
+      {
+         using face_map_type = std::map<std::string, cairo_font_face_t*>;
+         using descr_map_type = std::unordered_map<std::size_t, std::vector<font_descr_entry>>;
 
-         struct cleanup
+         ~font_cache()
          {
-            ~cleanup()
-            {
-               std::lock_guard<std::mutex> lock(cairo_font_map_mutex_);
-               for (auto [key, scaled_font] : cairo_font_map_)
-                  cairo_font_face_destroy(scaled_font);
-               cairo_font_map_.clear();
-            }
-         };
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto [key, face] : faces)
+               cairo_font_face_destroy(face);
+            faces.clear();
+            descrs.clear();
+         }
+
+         face_map_type        faces;
+         descr_map_type       descrs;
+         std::mutex           mutex;
+      };
 
-         static cleanup cleanup_;
-         return { cairo_font_map_, cairo_font_map_mutex_ };
+      font_cache& get_font_cache()
+      {
+         static font_cache cache;
+         return cache;
       }
 
       int map_fc_weight(int w)
@@ -365,11 +427,22 @@ namespace cycfi { namespace elements
 
       struct font_entry
       {
+         font_entry(
+            std::string full_name, std::string file
+          , std::uint8_t weight, std::uint8_t slant, std::uint8_t stretch
+         )
+         : full_name(std::move(full_name))
+         , file(std::move(file))
+         , weight(weight)
+         , slant(slant)
+         , stretch(stretch)
+         {}
+
          font_entry(FcPattern* pat, FcChar8 const* full_name, FcChar8 const* file)
-         : pattern(fc::pattern_shallow_copy_tag{}, *pat)
-         , full_name(reinterpret_cast<char const*>(full_name))
+         : full_name(reinterpret_cast<char const*>(full_name))
          , file(reinterpret_cast<char const*>(file))
          {
+            fc::pattern pattern(fc::pattern_shallow_copy_tag{}, *pat);
             if (auto w = pattern.get_weight(); w)
                weight = map_fc_weight(*w); // map the weight (normalized 0 to 100)
             else
@@ -386,7 +459,6 @@ namespace cycfi { namespace elements
                stretch = font_constants::stretch_normal;
          }
 
-         fc::pattern pattern;
          std::string full_name;
          std::string file;
          std::uint8_t weight;
@@ -401,6 +473,177 @@ namespace cycfi { namespace elements
          return font_map_;
       }
 
+      ////////////////////////////////////////////////////////////////////////
+      // The font index
+      //
+      // Listing the fonts through fontconfig scans (or loads the caches of)
+      // all the configured font directories. We keep what we need from
+      // the listing in a file in the user's cache directory, along with a
+      // signature of the directories it came from: their paths and
+      // modification times, including their subdirectories, and those of
+      // the fontconfig configuration files. We list the fonts again only
+      // if the signature changes. Apps with different font directories
+      // have different index files.
+      ////////////////////////////////////////////////////////////////////////
+      constexpr char const* font_index_magic = "elements-font-index-2";
+
+      // FNV-1a. Unlike std::hash, it is the same from one run (and build)
+      // to the next.
+      struct fnv1a
+      {
+         void add(void const* data, std::size_t size)
+         {
+            auto p = static_cast<unsigned char const*>(data);
+            for (auto i = std::size_t(0); i != size; ++i)
+               value = (value ^ p[i]) * 0x100000001b3;
+         }
+
+         void add(std::string const& str)
+         {
+            // Include the terminating null, so that the strings we add
+            // stay apart
+            add(str.c_str(), str.size() + 1);
+         }
+
+         std::uint64_t value = 0xcbf29ce484222325;
+      };
+
+      fs::path font_index_dir()
+      {
+#if defined(ELEMENTS_HOST_UI_LIBRARY_WIN32)
+         if (auto dir = std::getenv("LOCALAPPDATA"))
+            return fs::path(dir) / "elements";
+#elif defined(__APPLE__)
+         if (auto dir = std::getenv("HOME"))
+            return fs::path(dir) / "Library" / "Caches" / "elements";
+#else
+         if (auto dir = std::getenv("XDG_CACHE_HOME"); dir && *dir)
+            return fs::path(dir) / "elements";
+         if (auto dir = std::getenv("HOME"))
+            return fs::path(dir) / ".cache" / "elements";
+#endif
+         return {};
+      }
+
+      fs::path font_index_path(std::vector<fs::path> const& font_paths)
+      {
+         auto dir = font_index_dir();
+         if (dir.empty())
+            return {};
+
+         fnv1a h;
+         for (auto const& path : font_paths)
+            h.add(path.generic_string());
+
+         std::ostringstream name;
+         name << "font_index_" << std::hex << std::setw(16) << std::setfill('0') << h.value;
+         return dir / name.str();
+      }
+
+      std::uint64_t font_index_signature(std::vector<fs::path> const& paths)
+      {
+         fnv1a sig;
+         std::error_code ec;
+         auto&& add = [&](fs::path const& path)
+         {
+            sig.add(path.generic_string());
+            auto time = fs::last_write_time(path, ec);
+            if (!ec)
+            {
+               std::int64_t count = time.time_since_epoch().count();
+               sig.add(&count, sizeof(count));
+            }
+         };
+
+         for (auto const& path : paths)
+         {
+            add(path);
+            if (!fs::is_directory(path, ec))
+               continue;
+
+            auto const options = fs::directory_options::skip_permission_denied;
+            for (fs::recursive_directory_iterator i{ path, options, ec }, last;
+               !ec && i != last; i.increment(ec))
+            {
+               if (i->is_directory(ec))
+                  add(i->path());
+            }
+         }
+         return sig.value;
+      }
+
+      bool load_font_index(font_map_type& map, fs::path const& index, std::uint64_t sig)
+      {
+         std::ifstream file(index, std::ios::binary);
+         std::string line;
+         if (!getline(file, line) || line != font_index_magic)
+            return false;
+         if (!getline(file, line) || line != std::to_string(sig))
+            return false;
+
+         // One font per line: family, full name, file, weight, slant and
+         // stretch, separated by tabs.
+         while (getline(file, line))
+         {
+            std::istringstream str(line);
+            std::string family, full_name, path;
+            int weight, slant, stretch;
+            if (!getline(str, family, '\t')
+               || !getline(str, full_name, '\t')
+               || !getline(str, path, '\t')
+               || !(str >> weight >> slant >> stretch))
+            {
+               map.clear();
+               return false;
+            }
+            map[family].push_back(
+               font_entry(std::move(full_name), std::move(path), weight, slant, stretch)
+            );
+         }
+         return !map.empty();
+      }
+
+      void save_font_index(font_map_type const& map, fs::path const& index, std::uint64_t sig)
+      {
+         // Write to a temporary file first so that other processes never
+         // see a partial index
+         std::error_code ec;
+         fs::create_directories(index.parent_path(), ec);
+         auto temp = index;
+         temp += ".tmp";
+         {
+            std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+            if (!file)
+               return;
+
+            auto&& valid = [](std::string const& s)
+            {
+               return s.find_first_of("\t\n") == std::string::npos;
+            };
+
+            file << font_index_magic << '\n' << sig << '\n';
+            for (auto const& [family, entries] : map)
+            {
+               if (!valid(family))
+                  continue;
+               for (auto const& e : entries)
+               {
+                  if (!valid(e.full_name) || !valid(e.file))
+                     continue;
+                  file << family << '\t' << e.full_name << '\t' << e.file << '\t'
+                     << int(e.weight) << ' ' << int(e.slant) << ' ' << int(e.stretch) << '\n';
+               }
+            }
+            if (!file)
+            {
+               file.close();
+               fs::remove(temp, ec);
+               return;
+            }
+         }
+         fs::rename(temp, index, ec);
+      }
+
       void init_font_map()
       {
          std::vector<fs::path> paths = font_paths();
@@ -416,11 +659,23 @@ namespace cycfi { namespace elements
          paths.push_back(fs::path(windir) / "fonts");
 #endif
 #endif
+         // Register the app's font directories whether or not we load the
+         // index, so that fontconfig knows the same fonts either way
          fc::config& conf = fc::instance();
-
          for (auto& path : paths)
             conf.app_font_add_dir(reinterpret_cast<FcChar8 const*>(path.generic_string().c_str()));
 
+         auto index = font_index_path(paths);
+         std::uint64_t sig = 0;
+         if (!index.empty())
+         {
+            auto sig_paths = fc::config_paths();
+            sig_paths.insert(sig_paths.begin(), paths.begin(), paths.end());
+            sig = font_index_signature(sig_paths);
+            if (load_font_index(font_map(), index, sig))
+               return;
+         }
+
          fc::pattern pat(fc::pattern_empty_tag{});
          fc::object_set os(FC_FAMILY, FC_FULLNAME, FC_WIDTH, FC_WEIGHT, FC_SLANT, FC_FILE);
          fc::font_set_ptr fs = fc::font_list(conf.get(), pat, os);
@@ -440,6 +695,9 @@ namespace cycfi { namespace elements
                font_map()[key].push_back(font_entry(font, full_name, file));
             }
          }
+
+         if (!index.empty() && !font_map().empty())
+            save_font_index(font_map(), index, sig);
       }
 
       font_entry const* match(font_descr descr)
@@ -634,11 +892,25 @@ namespace cycfi { namespace elements
       static free_type_library ft_lib;
 #endif
 
+      auto& cache = get_font_cache();
+      std::lock_guard<std::mutex> lock(cache.mutex);
+
+      // Have we seen this descriptor before?
+      auto& bucket = cache.descrs[hash_value(descr)];
+      for (auto const& entry : bucket)
+      {
+         if (entry.matches(descr))
+         {
+            if (entry.face)
+               _handle = cairo_font_face_reference(entry.face);
+            return;
+         }
+      }
+
       auto match_ptr = match(descr);
       if (match_ptr)
       {
-         auto [cairo_font_map, cairo_font_map_mutex] = get_cairo_font_map();
-         std::lock_guard<std::mutex> lock(cairo_font_map_mutex);
+         auto& cairo_font_map = cache.faces;
          if (auto it = cairo_font_map.find(match_ptr->full_name); it != cairo_font_map.end())
          {
             _handle = cairo_font_face_reference(it->second);
@@ -670,6 +942,12 @@ namespace cycfi { namespace elements
       {
          _handle = nullptr;
       }
+
+      // If we could not load the face, we'll remember that too
+      bucket.push_back(
+         { std::string{ descr._families }, descr._weight, descr._slant, descr._stretch
+         , _handle }
+      );
    }
 
    font::font(font const& rhs)
@@ -6,10 +6,273 @@
 #include <elements/support/glyphs.hpp>
 #include <elements/support/detail/scratch_context.hpp>
 
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+
 namespace cycfi { namespace elements
 {
    static detail::scratch_context scratch_context_;
 
+   namespace
+   {
+      ////////////////////////////////////////////////////////////////////////
+      // shaped_run_cache: LRU cache of shaped runs, bounded by bytes. Glyph
+      // positions are stored relative to the origin and offset to the
+      // requested start point on fetch. Each entry holds a reference to its
+      // scaled font, so a cached font pointer can never be recycled by cairo
+      // for another font while the entry is alive.
+      ////////////////////////////////////////////////////////////////////////
+      class shaped_run_cache
+      {
+      public:
+
+         using scaled_font = cairo_scaled_font_t;
+         using glyph = cairo_glyph_t;
+         using cluster = cairo_text_cluster_t;
+         using cluster_flags = cairo_text_cluster_flags_t;
+
+         struct run
+         {
+            glyph*               glyphs;
+            int                  glyph_count;
+            cluster*             clusters;
+            int                  cluster_count;
+            cluster_flags        flags;
+            std::vector<float>   advances;
+         };
+
+                           ~shaped_run_cache();
+
+         bool              fetch(scaled_font* font, string_view text, point start, run& r);
+         void              store(scaled_font* font, string_view text, point start, run const& r);
+
+         std::size_t       capacity();
+         void              capacity(std::size_t bytes);
+         void              clear();
+
+      private:
+
+         struct entry
+         {
+            std::size_t          hash;
+            scaled_font*         font;
+            std::string          text;
+            std::vector<glyph>   glyphs;
+            std::vector<cluster> clusters;
+            std::vector<float>   advances;
+            cluster_flags        flags;
+            std::size_t          bytes;
+         };
+
+         struct key
+         {
+            std::size_t    hash;
+            scaled_font*   font;
+
+            bool operator==(key const& rhs) const
+            {
+               return hash == rhs.hash && font == rhs.font;
+            }
+         };
+
+         struct key_hash
+         {
+            std::size_t operator()(key const& k) const
+            {
+               return k.hash ^ (std::hash<scaled_font*>{}(k.font) << 1);
+            }
+         };
+
+         using entry_list = std::list<entry>;
+         using entry_map = std::unordered_map<key, entry_list::iterator, key_hash>;
+
+         bool              cacheable(std::size_t text_size) const;
+         void              evict(entry_list::iterator i);
+         void              trim(std::size_t capacity_);
+
+         std::mutex        _mutex;
+         entry_list        _entries;   // most recently used first
+         entry_map         _map;
+         std::size_t       _size = 0;
+         std::size_t       _capacity = 4 * 1024 * 1024;
+      };
+
+      shaped_run_cache& get_shaped_run_cache()
+      {
+         static shaped_run_cache cache;
+         return cache;
+      }
+
+      shaped_run_cache::~shaped_run_cache()
+      {
+         trim(0);
+      }
+
+      bool shaped_run_cache::cacheable(std::size_t text_size) const
+      {
+         // Do not let a single large run (e.g. a whole document) flush the
+         // cache. The glyphs of a run always take more space than its text.
+         return text_size && (text_size <= _capacity / 8);
+      }
+
+      bool shaped_run_cache::fetch(scaled_font* font, string_view text, point start, run& r)
+      {
+         std::lock_guard<std::mutex> lock(_mutex);
+         if (!cacheable(text.size()))
+            return false;
+
+         auto i = _map.find(key{ std::hash<string_view>{}(text), font });
+         if (i == _map.end() || i->second->text != text)
+            return false;
+
+         // Move the entry to the front (most recently used)
+         _entries.splice(_entries.begin(), _entries, i->second);
+         entry const& e = *i->second;
+
+         r.glyph_count = int(e.glyphs.size());
+         r.cluster_count = int(e.clusters.size());
+         r.flags = e.flags;
+         r.glyphs = cairo_glyph_allocate(r.glyph_count);
+         r.clusters = cairo_text_cluster_allocate(r.cluster_count);
+
+         for (int j = 0; j != r.glyph_count; ++j)
+         {
+            r.glyphs[j] = e.glyphs[j];
+            r.glyphs[j].x += start.x;
+            r.glyphs[j].y += start.y;
+         }
+         std::memcpy(r.clusters, e.clusters.data(), r.cluster_count * sizeof(cluster));
+         r.advances = e.advances;
+         return true;
+      }
+
+      void shaped_run_cache::store(scaled_font* font, string_view text, point start, run const& r)
+      {
+         std::lock_guard<std::mutex> lock(_mutex);
+         if (!cacheable(text.size()))
+            return;
+
+         auto k = key{ std::hash<string_view>{}(text), font };
+         if (auto i = _map.find(k); i != _map.end())
+            evict(i->second); // stale (hash collision) or duplicate entry
+
+         entry e{
+            k.hash, cairo_scaled_font_reference(font), std::string{ text }
+          , std::vector<glyph>(r.glyphs, r.glyphs + r.glyph_count)
+          , std::vector<cluster>(r.clusters, r.clusters + r.cluster_count)
+          , r.advances, r.flags, 0
+         };
+
+         for (auto& g : e.glyphs)
+         {
+            g.x -= start.x;
+            g.y -= start.y;
+         }
+
+         e.bytes = sizeof(entry) + e.text.size()
+            + (e.glyphs.size() * sizeof(glyph))
+            + (e.clusters.size() * sizeof(cluster))
+            + (e.advances.size() * sizeof(float))
+            ;
+
+         _size += e.bytes;
+         _entries.push_front(std::move(e));
+         _map[k] = _entries.begin();
+         trim(_capacity);
+      }
+
+      void shaped_run_cache::evict(entry_list::iterator i)
+      {
+         _map.erase(key{ i->hash, i->font });
+         _size -= i->bytes;
+         cairo_scaled_font_destroy(i->font);
+         _entries.erase(i);
+      }
+
+      void shaped_run_cache::trim(std::size_t capacity_)
+      {
+         while (_size > capacity_ && !_entries.empty())
+            evict(std::prev(_entries.end()));
+      }
+
+      std::size_t shaped_run_cache::capacity()
+      {
+         std::lock_guard<std::mutex> lock(_mutex);
+         return _capacity;
+      }
+
+      void shaped_run_cache::capacity(std::size_t bytes)
+      {
+         std::lock_guard<std::mutex> lock(_mutex);
+         _capacity = bytes;
+         trim(_capacity);
+      }
+
+      void shaped_run_cache::clear()
+      {
+         std::lock_guard<std::mutex> lock(_mutex);
+         trim(0);
+      }
+   }
+
+   namespace
+   {
+      // Shape [first, last), or reuse a previously shaped run if we have one
+      void shape(
+         cairo_scaled_font_t* font
+       , char const* first, char const* last
+       , point start
+       , shaped_run_cache::run& r
+      )
+      {
+         auto& cache = get_shaped_run_cache();
+         auto  text = string_view(first, last - first);
+         if (cache.fetch(font, text, start, r))
+            return;
+
+         r.glyphs = nullptr;
+         r.clusters = nullptr;
+         auto stat = cairo_scaled_font_text_to_glyphs(
+            font, start.x, start.y, first, int(last - first),
+            &r.glyphs, &r.glyph_count, &r.clusters, &r.cluster_count,
+            &r.flags);
+
+         if (stat != CAIRO_STATUS_SUCCESS)
+            throw failed_to_build_master_glyphs{};
+
+         // Compute the advance table, once, so that line breaking, measuring
+         // and hit testing need not query the font for each glyph.
+         r.advances.resize(r.glyph_count);
+         for (int i = 0; i != r.glyph_count; ++i)
+         {
+            cairo_text_extents_t extents;
+            cairo_scaled_font_glyph_extents(font, r.glyphs + i, 1, &extents);
+            r.advances[i] = extents.x_advance;
+         }
+
+         cache.store(font, text, start, r);
+      }
+   }
+
+   std::size_t shaped_run_cache_capacity()
+   {
+      return get_shaped_run_cache().capacity();
+   }
+
+   void shaped_run_cache_capacity(std::size_t bytes)
+   {
+      get_shaped_run_cache().capacity(bytes);
+   }
+
+   void clear_shaped_run_cache()
+   {
+      get_shaped_run_cache().clear();
+   }
+
    glyphs::glyphs(char const* first, char const* last)
     : _first(first)
     , _last(last)
@@ -33,6 +296,7 @@ namespace cycfi { namespace elements
     , _clusters(master._clusters + cluster_start)
     , _cluster_count(cluster_end - cluster_start)
     , _clusterflags(master._clusterflags)
+    , _advances(master._advances + glyph_start)
    {
       CYCFI_ASSERT(_first, "Precondition failure: _first must not be null");
       CYCFI_ASSERT(_last, "Precondition failure: _last must not be null");
@@ -69,6 +333,7 @@ namespace cycfi { namespace elements
 
          _glyph_count -= glyph_index;
          _glyphs += glyph_index;
+         _advances += glyph_index;
          _cluster_count -= clusters_skipped;
          _clusters = cluster;
          _first += clusters_skipped;
@@ -114,10 +379,8 @@ namespace cycfi { namespace elements
 
       if (_glyph_count)
       {
-         cairo_text_extents_t extents;
-         auto glyph = _glyphs + _glyph_count -1;
-         cairo_scaled_font_glyph_extents(_scaled_font, glyph, 1, &extents);
-         return (glyph->x + extents.x_advance) - _glyphs->x;
+         auto last = _glyph_count - 1;
+         return (_glyphs[last].x + _advances[last]) - _glyphs->x;
       }
       return 0;
    }
@@ -162,6 +425,21 @@ namespace cycfi { namespace elements
       build(start);
    }
 
+   master_glyphs::master_glyphs(
+      char const* first
+    , char const* last
+    , master_glyphs const& source
+    , std::size_t chunk_size
+    , std::atomic<bool> const* cancelled
+    , point start
+   )
+    : glyphs(first, last)
+   {
+      canvas cnv{ *scratch_context_.context() };
+      _scaled_font = cairo_scaled_font_reference(source._scaled_font);
+      build(start, chunk_size, cancelled);
+   }
+
    master_glyphs::master_glyphs(master_glyphs&& rhs)
     : glyphs(rhs._first, rhs._last)
    {
@@ -171,16 +449,24 @@ namespace cycfi { namespace elements
       _clusters = rhs._clusters;
       _cluster_count = rhs._cluster_count;
       _clusterflags = rhs._clusterflags;
+      _advance_table = std::move(rhs._advance_table);
+      _advances = _advance_table.data();
 
       rhs._glyphs = nullptr;
       rhs._clusters = nullptr;
       rhs._scaled_font = nullptr;
+      rhs._advances = nullptr;
    }
 
    master_glyphs& master_glyphs::operator=(master_glyphs&& rhs)
    {
       if (&rhs != this)
       {
+         // Release what we currently hold
+         clear();
+         if (_scaled_font)
+            cairo_scaled_font_destroy(_scaled_font);
+
          _first = rhs._first;
          _last = rhs._last;
          _scaled_font = rhs._scaled_font;
@@ -189,29 +475,26 @@ namespace cycfi { namespace elements
          _clusters = rhs._clusters;
          _cluster_count = rhs._cluster_count;
          _clusterflags = rhs._clusterflags;
+         _advance_table = std::move(rhs._advance_table);
+         _advances = _advance_table.data();
 
          rhs._glyphs = nullptr;
          rhs._clusters = nullptr;
          rhs._scaled_font = nullptr;
+         rhs._advances = nullptr;
       }
       return *this;
    }
 
    master_glyphs::~master_glyphs()
    {
-      if (_glyphs)
-         cairo_glyph_free(_glyphs);
-      if (_clusters)
-         cairo_text_cluster_free(_clusters);
+      clear();
       if (_scaled_font)
          cairo_scaled_font_destroy(_scaled_font);
-
-      _glyphs = nullptr;
-      _clusters = nullptr;
       _scaled_font = nullptr;
    }
 
-   void master_glyphs::text(char const* first, char const* last, point start)
+   void master_glyphs::clear()
    {
       if (_glyphs)
       {
@@ -223,7 +506,15 @@ namespace cycfi { namespace elements
          cairo_text_cluster_free(_clusters);
          _clusters = nullptr;
       }
+      _glyph_count = 0;
+      _cluster_count = 0;
+      _advance_table.clear();
+      _advances = nullptr;
+   }
 
+   void master_glyphs::text(char const* first, char const* last, point start)
+   {
+      clear();
       _first = first;
       _last = last;
       build(start);
@@ -277,9 +568,7 @@ namespace cycfi { namespace elements
             cairo_glyph_t*  glyph = _glyphs + glyph_index;
 
             // Check if we exceeded the line width:
-            cairo_text_extents_t extents;
-            cairo_scaled_font_glyph_extents(_scaled_font, glyph, 1, &extents);
-            if (((glyph->x + extents.x_advance) - start_x) > width)
+            if (((glyph->x + _advances[glyph_index]) - start_x) > width)
             {
                // Add the line if we did (exceed the line width)
                add_line();
@@ -308,28 +597,66 @@ namespace cycfi { namespace elements
        , start_glyph_index, _glyph_count
        , start_cluster_index, _cluster_count
        , *this
-       , lines.size() > 1 // skip leading spaces if this is not the first line
+       , lines.size() > 0 // skip leading spaces if this is not the first line
       };
 
       lines.push_back(std::move(glyph_));
    }
 
-   void master_glyphs::build(point start)
+   void master_glyphs::build(point start, std::size_t chunk_size, std::atomic<bool> const* cancelled)
    {
       // reurn early if there's nothing to build
       if (_first == _last)
          return;
 
-      auto stat = cairo_scaled_font_text_to_glyphs(
-         _scaled_font, start.x, start.y, _first, int(_last - _first),
-         &_glyphs, &_glyph_count, &_clusters, &_cluster_count,
-         &_clusterflags);
+      shaped_run_cache::run r;
+      auto last = next_utf8_chunk(_first, _last, chunk_size);
+      if (last == _last)
+      {
+         shape(_scaled_font, _first, _last, start, r);
+         _glyphs = r.glyphs;
+         _glyph_count = r.glyph_count;
+         _clusters = r.clusters;
+         _cluster_count = r.cluster_count;
+         _clusterflags = r.flags;
+         _advance_table = std::move(r.advances);
+         _advances = _advance_table.data();
+         return;
+      }
 
-      if (stat != CAIRO_STATUS_SUCCESS)
+      // Shape the text chunk by chunk. Each chunk starts where the one
+      // before it ended.
+      std::vector<glyph>   glyphs_;
+      std::vector<cluster> clusters_;
+      for (auto first = _first; first != _last; first = last)
       {
-         _glyphs = nullptr;
-         _clusters = nullptr;
-         throw failed_to_build_master_glyphs{};
+         if (cancelled && *cancelled)
+         {
+            _advance_table.clear();
+            return;
+         }
+
+         last = next_utf8_chunk(first, _last, chunk_size);
+         shape(_scaled_font, first, last, start, r);
+         glyphs_.insert(glyphs_.end(), r.glyphs, r.glyphs + r.glyph_count);
+         clusters_.insert(clusters_.end(), r.clusters, r.clusters + r.cluster_count);
+         _advance_table.insert(_advance_table.end(), r.advances.begin(), r.advances.end());
+         _clusterflags = r.flags;
+         if (r.glyph_count)
+         {
+            auto const& g = r.glyphs[r.glyph_count - 1];
+            start.x = g.x + r.advances[r.glyph_count - 1];
+         }
+         cairo_glyph_free(r.glyphs);
+         cairo_text_cluster_free(r.clusters);
       }
+
+      _glyph_count = int(glyphs_.size());
+      _glyphs = cairo_glyph_allocate(_glyph_count);
+      std::copy(glyphs_.begin(), glyphs_.end(), _glyphs);
+      _cluster_count = int(clusters_.size());
+      _clusters = cairo_text_cluster_allocate(_cluster_count);
+      std::copy(clusters_.begin(), clusters_.end(), _clusters);
+      _advances = _advance_table.data();
    }
 }}
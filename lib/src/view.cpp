@@ -6,26 +6,67 @@
 #include <elements/view.hpp>
 #include <elements/window.hpp>
 #include <elements/support/context.hpp>
+#include <algorithm>
+#include <iterator>
 
  namespace cycfi { namespace elements
  {
+   namespace
+   {
+      // All the views, for invalidate_limits to find those an element is in
+      std::vector<view*>& views()
+      {
+         static std::vector<view*> views_;
+         return views_;
+      }
+   }
+
+   void invalidate_limits(element const& e)
+   {
+      // The views that drew the element know it is theirs. We cannot tell
+      // where an element that was not drawn yet is.
+      auto found = false;
+      for (auto v : views())
+      {
+         if (v->_bounds_index.contains(&e))
+         {
+            v->invalidate_limits();
+            found = true;
+         }
+      }
+
+      if (!found)
+      {
+         for (auto v : views())
+            v->invalidate_limits();
+      }
+   }
+
    view::view(extent size_)
     : base_view(size_)
     , _main_element(make_scaled_content())
-    , _work(_io)
-   {}
+    , _io(*this)
+    , _tracking_timer(_io)
+   {
+      views().push_back(this);
+   }
 
    view::view(host_view_handle h)
     : base_view(h)
     , _main_element(make_scaled_content())
-    , _work(_io)
-   {}
+    , _io(*this)
+    , _tracking_timer(_io)
+   {
+      views().push_back(this);
+   }
 
    view::view(window& win)
     : base_view(win.host())
     , _main_element(make_scaled_content())
-    , _work(_io)
+    , _io(*this)
+    , _tracking_timer(_io)
    {
+      views().push_back(this);
       on_change_limits = [&win](view_limits limits_)
       {
          win.limits(limits_);
@@ -35,31 +76,44 @@
 
    view::~view()
    {
+      auto& all = views();
+      all.erase(std::find(all.begin(), all.end(), this));
       _io.stop();
+
+      // Let go of our elements while _io is still around. Some may have
+      // work in flight that posts to us (e.g. static_text_box layouts),
+      // which they cancel when destroyed.
+      _content.clear();
    }
 
-   void view::set_limits()
+   void view::set_limits(bool force)
    {
       if (_content.empty())
          return;
 
-      auto surface_ = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, nullptr);
-      auto context_ = cairo_create(surface_);
-      canvas cnv{ *context_ };
-      cnv.pre_scale(hdpi_scale());
+      // Skip the evaluation if no element in the view invalidated the limits
+      if (!force && _limits_evaluated == _limits_generation)
+         return;
+      _limits_evaluated = _limits_generation;
+      ++_limits_evaluations;
+
+      view_limits limits_;
+      {
+         detail::scratch_context::scope scratch{ _scratch };
+         canvas cnv{ *scratch.context() };
+         cnv.pre_scale(hdpi_scale());
+
+         // Update the limits and constrain the window size to the limits
+         basic_context bctx{ *this, cnv };
+         limits_ = _main_element.limits(bctx);
+      }
 
-      // Update the limits and constrain the window size to the limits
-      basic_context bctx{ *this, cnv };
-      auto limits_ = _main_element.limits(bctx);
       if (limits_.min != _current_limits.min || limits_.max != _current_limits.max)
       {
          _current_limits = limits_;
          if (on_change_limits)
             on_change_limits(limits_);
       }
-
-      cairo_surface_destroy(surface_);
-      cairo_destroy(context_);
    }
 
    void view::draw(cairo_t* context_, rect dirty_)
@@ -68,43 +122,56 @@
          return;
 
       _dirty = dirty_;
+      _layout_arena.reset();
 
       // Update the limits and constrain the window size to the limits
+      _limits_evaluations = 0;
       set_limits();
 
+      // Keep the inverse of the host's transform to map the bounds of the
+      // elements we draw back to view coordinates (see record_bounds).
+      cairo_get_matrix(context_, &_device_matrix);
+      cairo_matrix_invert(&_device_matrix);
+      _draw_context = context_;
+
       canvas cnv{ *context_ };
       cnv.pre_scale(hdpi_scale());
       auto size_ = size();
       rect subj_bounds = { 0, 0, size_.x, size_.y };
+
+      // Forget the elements in the dirty rect. Those we still have record
+      // their bounds again as we draw them. Otherwise, the index keeps the
+      // elements that are gone, and finds them again if new elements take
+      // their addresses. The index looks only at the entries in the cells
+      // of the dirty rect. Its extent is the view, in device coordinates.
+      auto device_scale = std::max(hdpi_scale(), 1.0f);
+      _bounds_index.extent({ 0, 0, size_.x * device_scale, size_.y * device_scale });
+      _bounds_index.erase(dirty_);
       context ctx{ *this, cnv, &_main_element, subj_bounds };
 
       // layout the subject only if the window bounds changes
       if (subj_bounds != _current_bounds)
       {
          _current_bounds = subj_bounds;
+         _bounds_index.clear();
          _main_element.layout(ctx);
       }
 
       // draw the subject
+      record_bounds(ctx);
       _main_element.draw(ctx);
+      _draw_context = nullptr;
    }
 
-   namespace
+   template <typename F>
+   void view::call(F f)
    {
-      template <typename F, typename This>
-      void call(F f, This& self, rect _current_bounds)
-      {
-         auto surface_ = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, nullptr);
-         auto context_ = cairo_create(surface_);
-         canvas cnv{ *context_ };
-         cnv.pre_scale(self.hdpi_scale());
-         context ctx { self, cnv, &self.main_element(), _current_bounds };
-
-         f(ctx, self.main_element());
+      detail::scratch_context::scope scratch{ _scratch };
+      canvas cnv{ *scratch.context() };
+      cnv.pre_scale(hdpi_scale());
+      context ctx { *this, cnv, &_main_element, _current_bounds };
 
-         cairo_surface_destroy(surface_);
-         cairo_destroy(context_);
-      }
+      f(ctx, _main_element);
    }
 
    void view::layout()
@@ -112,9 +179,12 @@
       if (_current_bounds.is_empty())
          return;
 
+      _bounds_index.clear();
+      _layout_arena.reset();
+      invalidate_limits();
+
       call(
-         [](auto const& ctx, auto& _main_element) { _main_element.layout(ctx); },
-         *this, _current_bounds
+         [](auto const& ctx, auto& _main_element) { _main_element.layout(ctx); }
       );
 
       refresh();
@@ -125,14 +195,67 @@
       if (_current_bounds.is_empty())
          return;
 
+      // Only the element and the containers it is in need a relayout. The
+      // others skip theirs if their bounds did not change (see
+      // layout_state). We know the containers of the elements we have
+      // drawn. If we have not drawn the element, or do not know all its
+      // containers, lay out everything, unless it is a layer (e.g. a popup
+      // we just added).
+      if (!mark_layout_dirty(element) && !is_layer(element))
+         invalidate_limits();
+      set_limits(true);
+
+      _bounds_index.clear();
+      _layout_arena.reset();
       call(
-         [](auto const& ctx, auto& _main_element) { _main_element.layout(ctx); },
-         *this, _current_bounds
+         [](auto const& ctx, auto& _main_element) { _main_element.layout(ctx); }
       );
+      _layout_dirty.clear();
 
       refresh(element);
    }
 
+   bool view::mark_layout_dirty(element const& e)
+   {
+      if (!_bounds_index.contains(&e))
+         return false;
+
+      // Not all containers record the elements they draw (e.g. decks and
+      // dynamic lists do not). The chains are complete only if all of them
+      // reach the main element or a layer. An element drawn in more than
+      // one place has a chain for each.
+      auto complete = true;
+      std::vector<element const*> pending = { &e };
+      while (!pending.empty())
+      {
+         auto p = pending.back();
+         pending.pop_back();
+         if (!_layout_dirty.insert(p).second)
+            continue;
+
+         auto is_top = !_bounds_index.contains(p);
+         _bounds_index.for_each(p,
+            [&](element const* parent, rect)
+            {
+               if (parent)
+                  pending.push_back(parent);
+               else
+                  is_top = true;
+            }
+         );
+         if (is_top && p != &_main_element && !is_layer(*p))
+            complete = false;
+      }
+      return complete;
+   }
+
+   bool view::is_layer(element const& e) const
+   {
+      return std::find_if(_content.begin(), _content.end(),
+         [&e](auto const& layer) { return layer.get() == &e; }
+      ) != _content.end();
+   }
+
    float view::scale() const
    {
       return _main_element.scale();
@@ -141,29 +264,67 @@
    void view::scale(float val)
    {
       _main_element.scale(val);
+      invalidate_limits();
       refresh();
    }
 
-   void view::refresh()
+   namespace
    {
-      // Allow refresh to be called from another thread
-      _io.post(
-         [this]()
+      // Merge two rects if their bounding box does not waste more than
+      // this (as a fraction of the area of the two) on undamaged pixels.
+      constexpr float merge_slack = 1.25f;
+
+      // Past this many rects, we simply refresh their bounding box.
+      constexpr std::size_t max_damage_rects = 16;
+
+      void add_damage(std::vector<rect>& damage, rect r)
+      {
+         if (r.is_empty())
+            return;
+
+         for (auto i = damage.begin(); i != damage.end(); )
          {
-            base_view::refresh();
+            auto merged = max(*i, r);
+            if (area(merged) <= (area(*i) + area(r)) * merge_slack)
+            {
+               // The merged rect may now merge with the ones we've seen
+               r = merged;
+               damage.erase(i);
+               i = damage.begin();
+            }
+            else
+            {
+               ++i;
+            }
          }
-      );
+         damage.push_back(r);
+
+         if (damage.size() > max_damage_rects)
+         {
+            for (auto const& d : damage)
+               r = max(r, d);
+            damage.clear();
+            damage.push_back(r);
+         }
+      }
+   }
+
+   void view::refresh()
+   {
+      // Allow refresh to be called from another thread
+      std::lock_guard<std::mutex> lock(_refresh_mutex);
+      _refresh_all = true;
+      _damage.clear();
+      wake();
    }
 
    void view::refresh(rect area)
    {
       // Allow refresh to be called from another thread
-      _io.post(
-         [this, area]()
-         {
-            base_view::refresh(area);
-         }
-      );
+      std::lock_guard<std::mutex> lock(_refresh_mutex);
+      if (!_refresh_all)
+         add_damage(_damage, area);
+      wake();
    }
 
    void view::refresh(element& element, int outward)
@@ -171,22 +332,129 @@
       if (_current_bounds.is_empty())
          return;
 
-      _io.post(
-         [this, &element, outward]()
+      std::lock_guard<std::mutex> lock(_refresh_mutex);
+      auto i = std::find_if(_element_refresh.begin(), _element_refresh.end(),
+         [&element](auto const& r) { return r.first == &element; });
+
+      if (i == _element_refresh.end())
+         _element_refresh.push_back({ &element, outward });
+      else
+         i->second = std::max(i->second, outward);
+      wake();
+   }
+
+   void view::flush_refresh()
+   {
+      element_refresh_list elements;
+      {
+         std::lock_guard<std::mutex> lock(_refresh_mutex);
+         elements.swap(_element_refresh);
+      }
+
+      // Get the bounds of the elements from the index. Search the element
+      // tree only for those that are not there. This adds to the damage
+      // list.
+      elements.erase(
+         std::remove_if(elements.begin(), elements.end(),
+            [this](auto const& r)
+            {
+               std::vector<rect> bounds;
+               if (!find_bounds(*r.first, r.second, bounds))
+                  return false;
+               for (auto const& b : bounds)
+                  refresh(b);
+               return true;
+            }
+         ),
+         elements.end()
+      );
+
+      if (!elements.empty() && !_current_bounds.is_empty())
+      {
+         call(
+            [&elements](auto const& ctx, auto& _main_element)
+            {
+               for (auto const& r : elements)
+                  _main_element.refresh(ctx, *r.first, r.second);
+            }
+         );
+      }
+
+      std::vector<rect> damage;
+      bool refresh_all;
+      {
+         std::lock_guard<std::mutex> lock(_refresh_mutex);
+         damage.swap(_damage);
+         refresh_all = _refresh_all;
+         _refresh_all = false;
+      }
+
+      if (refresh_all)
+      {
+         base_view::refresh();
+      }
+      else
+      {
+         for (auto const& r : damage)
+            base_view::refresh(r);
+      }
+   }
+
+   void view::record_bounds(context const& ctx)
+   {
+      // Only the elements drawn to the view. Elements may also be drawn
+      // off-screen, e.g. to a pixmap.
+      if (&ctx.canvas.cairo_context() != _draw_context)
+         return;
+
+      auto to_view = [&](point p)
+      {
+         p = ctx.canvas.user_to_device(p);
+         double x = p.x, y = p.y;
+         cairo_matrix_transform_point(&_device_matrix, &x, &y);
+         return point(x, y);
+      };
+
+      auto tl = to_view(ctx.bounds.top_left());
+      auto br = to_view(ctx.bounds.bottom_right());
+      _bounds_index.record(
+         ctx.element
+       , ctx.parent? ctx.parent->element : nullptr
+       , { tl.x, tl.y, br.x, br.y }
+      );
+   }
+
+   bool view::find_bounds(element const& e, int outward, std::vector<rect>& bounds) const
+   {
+      // The bounds of all the places the element (or its container,
+      // outward levels up) was drawn in. We know them only if we know
+      // every one of them.
+      if (!_bounds_index.contains(&e))
+         return false;
+
+      auto found = true;
+      _bounds_index.for_each(&e,
+         [&](element const* parent, rect b)
          {
-            call(
-               [&element, outward](auto const& ctx, auto& _main_element)
-               {
-                  _main_element.refresh(ctx, element, outward);
-               },
-               *this, _current_bounds
-            );
+            if (outward == 0)
+               bounds.push_back(b);
+            else if (!parent || !find_bounds(*parent, outward-1, bounds))
+               found = false;
          }
       );
+      return found;
    }
 
    void view::refresh(context const& ctx, int outward)
    {
+      // Let the elements this one is in know that it changed (e.g. a cache
+      // has to render it again).
+      for (auto p = ctx.parent; p; p = p->parent)
+      {
+         if (p->element)
+            p->element->on_child_refresh();
+      }
+
       context const* ctx_ptr = &ctx;
       while (outward > 0 && ctx_ptr)
       {
@@ -212,8 +480,7 @@
          {
             _main_element.click(ctx, btn);
             _is_focus = _main_element.focus();
-         },
-         *this, _current_bounds
+         }
       );
    }
 
@@ -227,8 +494,7 @@
          [btn](auto const& ctx, auto& _main_element)
          {
             _main_element.drag(ctx, btn);
-         },
-         *this, _current_bounds
+         }
       );
    }
 
@@ -242,8 +508,7 @@
          {
             if (!_main_element.cursor(ctx, p, status))
                set_cursor(cursor_type::arrow);
-         },
-         *this, _current_bounds
+         }
       );
    }
 
@@ -256,8 +521,7 @@
          [dir, p](auto const& ctx, auto& _main_element)
          {
             _main_element.scroll(ctx, dir, p);
-         },
-         *this, _current_bounds
+         }
       );
    }
 
@@ -271,8 +535,7 @@
          [k, &handled](auto const& ctx, auto& _main_element)
          {
              handled = _main_element.key(ctx, k);
-         },
-         *this, _current_bounds
+         }
       );
       return handled;
    }
@@ -287,30 +550,40 @@
          [info, &handled](auto const& ctx, auto& _main_element)
          {
              handled = _main_element.text(ctx, info);
-         },
-         *this, _current_bounds
+         }
       );
       return handled;
    }
 
+   namespace
+   {
+      std::size_t task_size(view::undo_redo_task const& t)
+      {
+         return sizeof(t) + t.size;
+      }
+   }
+
    void view::add_undo(undo_redo_task f)
    {
-      _undo_stack.push(f);
+      _undo_memory += task_size(f);
+      _undo_stack.push_back(std::move(f));
       if (has_redo())
       {
          // clear the redo stack
-         undo_stack_type empty{};
-         _redo_stack.swap(empty);
+         for (auto const& t : _redo_stack)
+            _undo_memory -= task_size(t);
+         _redo_stack.clear();
       }
+      trim_undo();
    }
 
    bool view::undo()
    {
       if (has_undo())
       {
-         auto t = _undo_stack.top();
-         _undo_stack.pop();
-         _redo_stack.push(t);
+         auto t = _undo_stack.back();
+         _undo_stack.pop_back();
+         _redo_stack.push_back(t);
          t.undo();  // execute undo function
          return true;
       }
@@ -321,15 +594,31 @@
    {
       if (has_redo())
       {
-         auto t = _redo_stack.top();
-         _undo_stack.push(t);
-         _redo_stack.pop();
+         auto t = _redo_stack.back();
+         _undo_stack.push_back(t);
+         _redo_stack.pop_back();
          t.redo();  // execute redo function
          return true;
       }
       return false;
    }
 
+   void view::undo_memory_limit(std::size_t bytes)
+   {
+      _undo_memory_limit = bytes;
+      trim_undo();
+   }
+
+   void view::trim_undo()
+   {
+      // Drop the oldest undo tasks, but always keep the latest
+      while (_undo_memory > _undo_memory_limit && _undo_stack.size() > 1)
+      {
+         _undo_memory -= task_size(_undo_stack.front());
+         _undo_stack.pop_front();
+      }
+   }
+
    void view::begin_focus()
    {
       if (_content.empty() || !_is_focus)
@@ -348,25 +637,68 @@
       refresh();
    }
 
+   namespace
+   {
+      // The frame rate when the host has no frame clock
+      constexpr auto frame_interval = std::chrono::microseconds(1000000 / 60);
+   }
+
    void view::poll()
    {
       _io.poll();
-      if (!_tracking.empty())
+
+      if (_animating && !_host_frames)
       {
-         for (auto it = _tracking.cbegin(); it != _tracking.cend(); /**/)
-         {
-            using namespace std::chrono_literals;
-            auto now = std::chrono::steady_clock::now();
-            if ((now - it->second) > 1s)
-            {
-               on_tracking(*it->first, tracking::end_tracking);
-               _tracking.erase(it++);
-            }
-            else
-            {
-               ++it;
-            }
-         }
+         auto now = std::chrono::steady_clock::now();
+         if (now - _last_frame >= frame_interval)
+            tick_animations(now);
+         if (_animating)
+            wake(_last_frame + frame_interval - now);
+      }
+
+      flush_refresh();
+   }
+
+   void view::frame()
+   {
+      if (_animating)
+         tick_animations(std::chrono::steady_clock::now());
+   }
+
+   void view::animate(animate_function f)
+   {
+      // Animations added while we tick start on the next frame
+      _new_animations.push_back(std::move(f));
+      if (!_animating)
+      {
+         _animating = true;
+         _host_frames = start_frames();
+         if (!_host_frames)
+            wake();
+      }
+   }
+
+   void view::tick_animations(time_point now)
+   {
+      _last_frame = now;
+      std::move(_new_animations.begin(), _new_animations.end(), std::back_inserter(_animations));
+      _new_animations.clear();
+
+      _animations.erase(
+         std::remove_if(_animations.begin(), _animations.end(),
+            [now](auto& f) { return !f(now); }
+         ),
+         _animations.end()
+      );
+
+      // Flush the refreshes of all the animations at once
+      flush_refresh();
+
+      if (_animations.empty() && _new_animations.empty())
+      {
+         _animating = false;
+         if (_host_frames)
+            stop_frames();
       }
    }
 
@@ -381,5 +713,47 @@
 
       if (state == tracking::end_tracking)
          _tracking.erase(&e);
+
+      using namespace std::chrono_literals;
+      if (!_tracking.empty() && !_tracking_scheduled)
+         schedule_end_tracking(1s);
+   }
+
+   void view::schedule_end_tracking(duration delay)
+   {
+      _tracking_scheduled = true;
+      _tracking_timer.expires_from_now(delay);
+      _tracking_timer.async_wait(
+         [this](auto const& err)
+         {
+            _tracking_scheduled = false;
+            if (!err)
+               end_tracking();
+         }
+      );
+   }
+
+   void view::end_tracking()
+   {
+      using namespace std::chrono_literals;
+      auto now = std::chrono::steady_clock::now();
+      auto next = time_point::max();
+      for (auto it = _tracking.cbegin(); it != _tracking.cend(); /**/)
+      {
+         if ((now - it->second) >= 1s)
+         {
+            on_tracking(*it->first, tracking::end_tracking);
+            _tracking.erase(it++);
+         }
+         else
+         {
+            next = std::min(next, it->second + 1s);
+            ++it;
+         }
+      }
+
+      // Check again when the next element is due
+      if (!_tracking.empty())
+         schedule_end_tracking(next - now);
    }
 }}